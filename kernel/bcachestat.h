@@ -0,0 +1,16 @@
+#ifndef _BCACHESTAT_H_
+#define _BCACHESTAT_H_
+#include "types.h"
+// buffer cache counters since boot, and its current make-up.
+struct bcachestat {
+  uint64 hits;      // bread()s that found the block cached
+  uint64 misses;    // bread()s that had to read it in, or wait for read-ahead
+  uint64 ghosthits; // blocks read in again soon after eviction from a1in
+  uint64 evictions; // cached blocks dropped to make room for others
+  uint64 ahead;     // blocks asked for by read-ahead
+  uint64 nbuf;      // buffers in the cache
+  uint64 nin;       // holding blocks read in once (a1in)
+  uint64 nam;       // holding blocks read again after eviction (am)
+};
+
+#endif
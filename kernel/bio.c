@@ -8,6 +8,9 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * Or, to keep several transfers in flight, start each with
+//     bsubmit and finish it with bwait. bsubmitv starts many
+//     at once, and sends adjacent blocks as one disk request.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -23,72 +26,551 @@
 #include "sleeplock.h"
 #include "utils.h"
 #include "virtio.h"
+#include "bcachestat.h"
+#include "defs.h"
 void
-virtio_disk_rw(struct buf *b, int write);
+virtio_disk_submit(struct buf **bv, int n, int write, int async);
+void
+iosched_wait(struct buf *b);
+void bpin(struct buf *b);
+void bunpin(struct buf *b);
+
+// cached blocks are hashed by (dev, blockno) into chains with
+// a lock each, so a cache hit touches only its own bucket.
+// binit() uses about a bucket per buffer the cache may grow
+// to, up to NBUCKET, so chains stay short as it grows.
+// lock order: bucket locks in index order, then bcache.lock.
+//
+// buffers are carved BPP to a page from kalloc(). the cache
+// starts at NBUF buffers and grows on a miss, rather than
+// evicting, until it holds maxpage pages; kalloc() calls
+// bshrink() to take idle pages back when memory runs out.
+//
+// replacement is 2Q, so one pass over a big file can't flush
+// the hot blocks. a block read in joins a1in, a FIFO that
+// hits don't reorder. while a1in holds more than a quarter of
+// the buffers, its oldest idle block is evicted first and its
+// number is remembered on the ghost list a1out. a block read
+// again while still remembered has proved it is reused, and
+// joins am, an LRU list holding the rest of the cache. so a
+// scan passes through a1in and leaves am alone. buffers that
+// hold no block yet sit on the free list and go first.
+#define NBUCKET 4099
+#define BPP     (PGSIZE / sizeof(struct buf))
+#define MINPAGE ((NBUF + BPP - 1) / BPP)
+#define NGHOST  1024
+#define NGHASH  64
+
+enum { BQ_FREE, BQ_A1IN, BQ_AM, NBQ };
+
+struct bbucket {
+  struct spinlock lock;
+  struct buf *head;       // chained through hnext
+};
+
+// a block evicted from a1in.
+struct ghost {
+  uint dev;               // 0 once it has been hit
+  uint blockno;
+  int next;               // next in its ghash chain, or -1
+};
+
 struct {
+  // protects the queues, the ghost list, the counts below,
+  // and the names of the buffers on the queues.
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // the queues, through prev/next, newest or most recently
+  // used at head.next. each holds all of its buffers,
+  // referenced or not; only idle ones are evicted.
+  struct buf q[NBQ];
+  int nq[NBQ];
+
+  // a1out: a ring of ghosts, oldest at gfirst, hashed by block.
+  struct ghost ghost[NGHOST];
+  int gfirst;
+  int ngh;
+  int ghash[NGHASH];
+
+  struct bbucket hash[NBUCKET];
+  int nbucket;            // buckets in use
+  int npage;              // pages of buffers
+  int maxpage;            // grow no further than this
+  int toppage;            // maxpage at boot; see bcachelimit()
+  volatile int nwait;     // bget()s sleeping for a free buffer, see bunref()
+  uint nfresh;            // names unused buffers, see bgrow()
+  uint64 hits;
+  uint64 misses;
+  uint64 ghosthits;
+  uint64 evictions;
+  uint64 ahead;
 } bcache;
 
+static struct bbucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.hash[(dev * 31 + blockno) % bcache.nbucket];
+}
+
+// queue b at the head of q. caller holds bcache.lock.
+static void
+bqpush(int q, struct buf *b)
+{
+  b->q = q;
+  b->next = bcache.q[q].next;
+  b->prev = &bcache.q[q];
+  bcache.q[q].next->prev = b;
+  bcache.q[q].next = b;
+  bcache.nq[q]++;
+}
+
+static void
+bqdel(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  bcache.nq[b->q]--;
+}
+
+static int*
+ghostchain(uint dev, uint blockno)
+{
+  return &bcache.ghash[(dev * 31 + blockno) % NGHASH];
+}
+
+// unhash ghost i, if it is still live.
+static void
+ghostunhash(int i)
+{
+  struct ghost *g = &bcache.ghost[i];
+  int *pp;
+
+  if(g->dev == 0)
+    return;
+  for(pp = ghostchain(g->dev, g->blockno); *pp != i; pp = &bcache.ghost[*pp].next)
+    ;
+  *pp = g->next;
+  g->dev = 0;
+}
+
+// remember a block evicted from a1in. a1out holds as many
+// blocks as half the cache, dropping the oldest.
+static void
+ghostadd(uint dev, uint blockno)
+{
+  int cap = bcache.npage * BPP / 2;
+  int i, *chain;
+
+  if(cap > NGHOST)
+    cap = NGHOST;
+  while(bcache.ngh > 0 && bcache.ngh >= cap){
+    ghostunhash(bcache.gfirst);
+    bcache.gfirst = (bcache.gfirst + 1) % NGHOST;
+    bcache.ngh--;
+  }
+  i = (bcache.gfirst + bcache.ngh++) % NGHOST;
+  chain = ghostchain(dev, blockno);
+  bcache.ghost[i].dev = dev;
+  bcache.ghost[i].blockno = blockno;
+  bcache.ghost[i].next = *chain;
+  *chain = i;
+}
+
+// is the block on a1out? forget it if so.
+static int
+ghosthit(uint dev, uint blockno)
+{
+  int i;
+
+  for(i = *ghostchain(dev, blockno); i >= 0; i = bcache.ghost[i].next){
+    if(bcache.ghost[i].dev == dev && bcache.ghost[i].blockno == blockno){
+      ghostunhash(i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// add a page of buffers to the cache. each is hashed under a
+// made-up block of dev 0, which holds no file system, so
+// bget() can recycle it like any other cached block.
+static int
+bgrow(void)
+{
+  struct buf *b, *page;
+  struct bbucket *bk;
+  int i;
+
+  acquire(&bcache.lock);
+  if(bcache.npage >= bcache.maxpage){
+    release(&bcache.lock);
+    return -1;
+  }
+  bcache.npage++;
+  release(&bcache.lock);
+
+  if((page = kalloc()) == 0){
+    acquire(&bcache.lock);
+    bcache.npage--;
+    release(&bcache.lock);
+    return -1;
+  }
+  memset(page, 0, PGSIZE);
+  for(i = 0; i < BPP; i++){
+    b = &page[i];
+    initsleeplock(&b->lock, "buffer");
+    b->blockno = __sync_fetch_and_add(&bcache.nfresh, 1);
+    bk = bbucket(0, b->blockno);
+    acquire(&bk->lock);
+    b->hnext = bk->head;
+    bk->head = b;
+    acquire(&bcache.lock);
+    bqpush(BQ_FREE, b);
+    release(&bcache.lock);
+    release(&bk->lock);
+  }
+  return 0;
+}
+
 void
 binit(void)
+{
+  initlock(&bcache.lock, "bcache");
+  for(int q = 0; q < NBQ; q++){
+    bcache.q[q].prev = &bcache.q[q];
+    bcache.q[q].next = &bcache.q[q];
+  }
+  for(int i = 0; i < NGHASH; i++)
+    bcache.ghash[i] = -1;
+
+  bcache.maxpage = kfreepages() / BCACHEFRAC;
+  if(bcache.maxpage < MINPAGE)
+    bcache.maxpage = MINPAGE;
+  bcache.toppage = bcache.maxpage;
+  bcache.nbucket = bcache.maxpage * BPP;
+  if(bcache.nbucket > NBUCKET)
+    bcache.nbucket = NBUCKET;
+  for(int i = 0; i < bcache.nbucket; i++)
+    initlock(&bcache.hash[i].lock, "bhash");
+  for(int i = 0; i < MINPAGE; i++)
+    if(bgrow() < 0)
+      panic("binit");
+}
+
+// take a reference to b; caller holds b's bucket lock.
+static void
+bref(struct buf *b)
+{
+  b->refcnt++;
+}
+
+// drop a reference; caller holds b's bucket lock. the last
+// one counts as a use: an am buffer moves to the head of am.
+// returns 1 if a bget() is waiting for an idle buffer; the
+// caller must wakeup(&bcache) once it has let go of the
+// bucket lock.
+//
+// b->q only changes under b's bucket lock, so only an am
+// buffer needs bcache.lock. a waiter raises nwait before its
+// last look for an idle buffer, and we read nwait after making
+// b idle, so either it sees b or we see it; taking bcache.lock
+// then waits until it is asleep.
+static int
+bunref(struct buf *b)
+{
+  int wake = 0;
+
+  if(--b->refcnt == 0){
+    if(b->q == BQ_AM){
+      acquire(&bcache.lock);
+      bqdel(b);
+      bqpush(BQ_AM, b);
+      release(&bcache.lock);
+    }
+    __sync_synchronize();
+    if(bcache.nwait > 0){
+      acquire(&bcache.lock);
+      wake = bcache.nwait > 0;
+      release(&bcache.lock);
+    }
+  }
+  return wake;
+}
+
+static struct buf*
+bfind(struct bbucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// unhash b; caller holds its bucket lock.
+static void
+bunhash(struct bbucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+// the oldest idle buffer on q, or 0. refcnt is read without
+// its bucket lock, so bget() checks again.
+static struct buf*
+bqidle(int q)
+{
+  struct buf *b;
+
+  for(b = bcache.q[q].prev; b != &bcache.q[q]; b = b->prev)
+    if(b->refcnt == 0)
+      return b;
+  return 0;
+}
+
+// pick a buffer to recycle. caller holds bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+
+  if((b = bqidle(BQ_FREE)) != 0)
+    return b;
+  if(bcache.nq[BQ_A1IN] > bcache.npage * BPP / 4 && (b = bqidle(BQ_A1IN)) != 0)
+    return b;
+  if((b = bqidle(BQ_AM)) != 0)
+    return b;
+  return bqidle(BQ_A1IN);
+}
+
+// lock b, which the caller has referenced. if nowait and
+// someone else holds it, drop the reference and return 0.
+static struct buf*
+blockbuf(struct buf *b, int nowait)
+{
+  struct bbucket *bk;
+  int wake;
+
+  if(!nowait){
+    acquiresleep(&b->lock);
+    return b;
   }
+  if(tryacquiresleep(&b->lock))
+    return b;
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
+  wake = bunref(b);
+  release(&bk->lock);
+  if(wake)
+    wakeup(&bcache);
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// with nowait, return 0 instead of sleeping for the buffer's
+// lock or for an idle buffer.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int nowait)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bbucket *bk = bbucket(dev, blockno), *ob, *first, *second;
+  struct buf *b, *c;
+  uint odev, oblock;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    bref(b);
+    release(&bk->lock);
+    return blockbuf(b, nowait);
+  }
+  release(&bk->lock);
+
+  // Not cached. grow the cache if we may, else recycle a
+  // buffer, else wait for one to go idle.
+  bgrow();
+  for(;;){
+    // the victim must move between buckets, so note it under
+    // bcache.lock, then take both bucket locks in order and
+    // check that neither it nor our block changed in between.
+    acquire(&bcache.lock);
+    if((b = bvictim()) == 0 && !nowait){
+      // look again once bunref() can see us waiting.
+      __sync_fetch_and_add(&bcache.nwait, 1);
+      if((b = bvictim()) == 0)
+        sleep(&bcache, &bcache.lock);
+      __sync_fetch_and_sub(&bcache.nwait, 1);
+    }
+    if(b == 0){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if(nowait)
+        return 0;
+      ob = bk;
+    } else {
+      odev = b->dev;
+      oblock = b->blockno;
+      release(&bcache.lock);
+      ob = bbucket(odev, oblock);
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
+    first = ob < bk ? ob : bk;
+    second = ob < bk ? bk : ob;
+    acquire(&first->lock);
+    if(second != first)
+      acquire(&second->lock);
+
+    if((c = bfind(bk, dev, blockno)) != 0){
+      // someone else read it in meanwhile.
+      bref(c);
+      b = c;
+    } else if(b && bfind(ob, odev, oblock) == b && b->refcnt == 0){
+      // the log pins a block until it is written home.
+      if(b->dirty)
+        panic("bget: dirty victim");
+      bref(b);
+      bunhash(ob, b);
+      b->hnext = bk->head;
+      bk->head = b;
+      acquire(&bcache.lock);
+      if(b->q == BQ_A1IN)
+        ghostadd(b->dev, b->blockno);
+      if(b->q != BQ_FREE)
+        bcache.evictions++;
+      bqdel(b);
+      if(ghosthit(dev, blockno)){
+        bcache.ghosthits++;
+        bqpush(BQ_AM, b);
+      } else {
+        bqpush(BQ_A1IN, b);
+      }
       b->dev = dev;
       b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      b->valid = 0;
+    } else {
+      b = 0;
     }
+
+    if(second != first)
+      release(&second->lock);
+    release(&first->lock);
+    if(b)
+      return blockbuf(b, nowait);
   }
-  panic("bget: no buffers");
-  return 0;
+}
+
+// free up to n pages from queue q whose buffers are all idle,
+// oldest first. caller holds every bcache lock.
+static int
+bshrinkq(int q, int n)
+{
+  struct buf *b, *page;
+  int i, freed = 0;
+
+  for(b = bcache.q[q].prev; b != &bcache.q[q] && freed < n && bcache.npage > MINPAGE; ){
+    page = (struct buf*)PGROUNDDOWN((uint64)b);
+    for(i = 0; i < BPP; i++)
+      if(page[i].refcnt != 0)
+        break;
+    if(i < BPP){
+      b = b->prev;
+      continue;
+    }
+    // step past this page's buffers before unlinking them.
+    while(b != &bcache.q[q] && PGROUNDDOWN((uint64)b) == (uint64)page)
+      b = b->prev;
+    for(i = 0; i < BPP; i++){
+      if(page[i].dirty)
+        panic("bshrink: dirty");
+      bqdel(&page[i]);
+      bunhash(bbucket(page[i].dev, page[i].blockno), &page[i]);
+    }
+    kfree(page);
+    bcache.npage--;
+    freed++;
+  }
+  return freed;
+}
+
+// give back up to n pages of idle buffers, keeping at least
+// MINPAGE. called by kalloc() when it runs dry, so it takes
+// only the bcache spinlocks and never sleeps. returns pages
+// freed.
+int
+bshrink(int n)
+{
+  int i, q, freed = 0;
+
+  if(bcache.npage <= MINPAGE)
+    return 0;
+  for(i = 0; i < bcache.nbucket; i++)
+    acquire(&bcache.hash[i].lock);
+  acquire(&bcache.lock);
+  for(q = 0; q < NBQ && freed < n; q++)
+    freed += bshrinkq(q, n - freed);
+  release(&bcache.lock);
+  for(i = bcache.nbucket - 1; i >= 0; i--)
+    release(&bcache.hash[i].lock);
+  return freed;
+}
+
+// cap the cache at nbuf buffers, no fewer than it starts with
+// and no more than binit() allowed, and give back idle pages
+// above the cap. nbuf <= 0 leaves the cap alone. lets a test
+// make the cache smaller than a file. returns the old cap.
+int
+bcachelimit(int nbuf)
+{
+  int old, n;
+
+  acquire(&bcache.lock);
+  old = bcache.maxpage * BPP;
+  if(nbuf > 0){
+    n = (nbuf + BPP - 1) / BPP;
+    if(n < MINPAGE)
+      n = MINPAGE;
+    if(n > bcache.toppage)
+      n = bcache.toppage;
+    bcache.maxpage = n;
+  }
+  n = bcache.npage - bcache.maxpage;
+  release(&bcache.lock);
+  if(n > 0)
+    bshrink(n);
+  return old;
+}
+
+// cache statistics, for the bcachestat system call.
+void
+bcachestat(struct bcachestat *st)
+{
+  acquire(&bcache.lock);
+  st->hits = bcache.hits;
+  st->misses = bcache.misses;
+  st->ghosthits = bcache.ghosthits;
+  st->evictions = bcache.evictions;
+  st->ahead = bcache.ahead;
+  st->nbuf = bcache.npage * BPP;
+  st->nin = bcache.nq[BQ_A1IN];
+  st->nam = bcache.nq[BQ_AM];
+  release(&bcache.lock);
+}
+
+// count a bread() as a hit or a miss. read-ahead goes through
+// bget() too, so this is done here rather than there; a block
+// still on its way in from a read-ahead is a miss.
+static void
+bcount(struct buf *b)
+{
+  if(b->valid)
+    __sync_fetch_and_add(&bcache.hits, 1);
+  else
+    __sync_fetch_and_add(&bcache.misses, 1);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -97,61 +579,175 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
+  bcount(b);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
+    if(!b->disk)   // else breadahead() got there first
+      bsubmit(b, 0);
+    bwait(b);
   }
   
   return b;
 }
 
+// like bread(), but also start reading rablock, which the
+// caller expects to want next.
+struct buf*
+breada(uint dev, uint blockno, uint rablock)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  bcount(b);
+  if(!b->valid && !b->disk)
+    bsubmit(b, 0);
+  breadahead(dev, rablock);
+  if(!b->valid)
+    bwait(b);
+  return b;
+}
+
+// start reading a block the caller expects to want soon, and
+// return without waiting.
+void
+breadahead(uint dev, uint blockno)
+{
+  breadaheadv(dev, &blockno, 1);
+}
+
+// start reading the n blocks the caller expects to want soon,
+// and return without waiting. a run of
+// adjacent blocks goes to the disk as one request. each read
+// keeps its buffer pinned until bdone(); b->disk is set while
+// the buffer is still locked, so a bread() that gets there
+// first waits for our read instead of starting its own. only
+// one buffer is locked at a time, and a pending run is queued
+// before anything that might sleep, since a bread() may be
+// waiting on it.
+void
+breadaheadv(uint dev, uint *blocks, int n)
+{
+  struct buf *run[MAXSEG], *b;
+  int i, nrun = 0;
+
+  __sync_fetch_and_add(&bcache.ahead, n);
+  for(i = 0; i < n; i++){
+    if(nrun > 0 && (nrun == MAXSEG || blocks[i] != run[nrun-1]->blockno + 1)){
+      virtio_disk_submit(run, nrun, 0, 1);
+      nrun = 0;
+    }
+    if(nrun == 0 || (b = bget(dev, blocks[i], 1)) == 0){
+      if(nrun > 0){
+        virtio_disk_submit(run, nrun, 0, 1);
+        nrun = 0;
+      }
+      b = bget(dev, blocks[i], 0);
+    }
+    if(!b->valid && !b->disk){
+      bpin(b);
+      b->disk = 1;
+      run[nrun++] = b;
+    }
+    brelse(b);
+  }
+  if(nrun > 0)
+    virtio_disk_submit(run, nrun, 0, 1);
+}
+
+// start reading or writing b, and return once the request is
+// queued. b must be locked, and stay locked until bwait().
+void
+bsubmit(struct buf *b, int write)
+{
+  bsubmitv(&b, 1, write);
+}
+
+// bsubmit() each of the n bufs in bv. a run of bufs holding
+// adjacent blocks goes to the disk as one request.
+void
+bsubmitv(struct buf **bv, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bv[i]->lock) || bv[i]->disk)
+      panic("bsubmit");
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n; j++)
+      if(bv[j]->dev != bv[i]->dev || bv[j]->blockno != bv[j-1]->blockno + 1)
+        break;
+    virtio_disk_submit(bv + i, j - i, write, 0);
+  }
+}
+
+// wait for b's transfer to finish; after a read, b is valid.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  iosched_wait(b);
+  b->valid = 1;
+}
+
+// a breadahead() read finished. called from the disk interrupt.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  bunpin(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bsubmit(b, 1);
+  bwait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If it is in am, move it to the head of that LRU list;
+// a1in keeps its FIFO order.
 void
 brelse(struct buf *b)
 {
+  struct bbucket *bk;
+  int wake;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  // b is referenced, so it can't move to another bucket.
+  bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
+  wake = bunref(b);
+  release(&bk->lock);
+  if(wake)
+    wakeup(&bcache);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bbucket *bk = bbucket(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bref(b);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
-}
-
+  struct bbucket *bk = bbucket(b->dev, b->blockno);
+  int wake;
 
+  acquire(&bk->lock);
+  wake = bunref(b);
+  release(&bk->lock);
+  if(wake)
+    wakeup(&bcache);
+}
@@ -3,15 +3,33 @@
 #include "sleeplock.h"
 #include "param.h"
 #include "fs.h"
+struct buf;
+
+// a disk request: a run of bufs holding adjacent blocks,
+// linked through qnext. kept in its first buf.
+struct ioreq {
+  struct buf *next;  // next waiting request, see iosched.c
+  int n;             // bufs in the request
+  uchar write;
+  uchar async;       // hand the bufs to bdone() when done
+  int q;             // scheduler queue, see iosched.c
+  uint64 queued;     // r_time() when it was queued
+};
+
 struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash chain
   uint blockno; 
   uint dev;
   uint refcnt;
   struct sleeplock lock;
   int disk;    // does disk "own" buf?
+  struct buf *qnext; // next buf in the same disk request
+  struct ioreq rq;
   int valid;   // has data been read from disk?
+  int dirty;   // modified in the cache, not yet written home
+  int q;       // replacement queue, see bio.c
   uchar data[BSIZE];
 };
 #endif
\ No newline at end of file
@@ -139,7 +139,7 @@ consoleintr(int c)
 
   switch(c){
   case C('P'):  // Print process list.
-    // procdump();
+    procdump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
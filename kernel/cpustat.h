@@ -0,0 +1,11 @@
+#ifndef _CPUSTAT_H_
+#define _CPUSTAT_H_
+#include "types.h"
+// per-hart utilisation, in timebase ticks.
+struct cpustat {
+  uint64 uptime;  // time since the hart entered scheduler()
+  uint64 idle;    // time spent halted in wfi
+  uint64 wakeups; // number of times the hart left wfi
+};
+
+#endif
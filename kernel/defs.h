@@ -14,10 +14,34 @@ int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 pagetable_t proc_pagetable(struct proc* proc);
 void proc_freepagetable(pagetable_t proc, uint64 sz);
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
+/* timer */
+struct timespec;
+void timerinit();
+void timer_rearm();
+void timer_slice();
+void timer_expire(uint64 now);
+int sleep_until(void* chan, struct spinlock* lk, uint64 when);
+uint64 ts2time(struct timespec* ts);
+void time2ts(uint64 t, struct timespec* ts);
+/* futex */
+void futexinit();
+int futex_wait(uint64 addr, int val, uint64 when);
+int futex_wake(uint64 addr, int n);
+/* spinlock */
+struct lockstat;
+int lockstat_top(struct lockstat* out, int n);
+/* fpu */
+void fpuinit();
+void fpu_switchout(struct proc* p);
+int fpu_trap(struct proc* p);
+void fpu_fork(struct proc* p, struct proc* np);
+void fpu_exec(struct proc* p);
+void fpu_free(struct proc* p);
 /* kmem */
 void kinit();
 void* kalloc();
 void kfree(void* pa);
+uint64 kfreepages();
 /* vm */
 int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len);
 pte_t* walk(pagetable_t pagetable, uint64 va, int alloc);
@@ -25,7 +49,16 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va);
 void uvmclear(pagetable_t pagetable, uint64 va);
 uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm);
 /* fs */
+struct bcachestat;
+void bcachestat(struct bcachestat* st);
+int bcachelimit(int nbuf);
 struct buf* bread(uint dev, uint blockno);
+struct buf* breada(uint dev, uint blockno, uint rablock);
+void breadahead(uint dev, uint blockno);
+void breadaheadv(uint dev, uint *blocks, int n);
+void bsubmit(struct buf *b, int write);
+void bsubmitv(struct buf **bv, int n, int write);
+void bwait(struct buf *b);
 void brelse(struct buf *b);
 void bwrite(struct buf *b);
 void fsinit(int dev);
@@ -39,6 +72,7 @@ void iupdate(struct inode* ip);
 struct inode* iget(uint dev, uint inum);
 struct inode* idup(struct inode* ip);
 void ilock(struct inode* ip);
+void ilockshared(struct inode* ip);
 void iunlock(struct inode* ip);
 void itrunc(struct inode* ip);
 void iput(struct inode* ip);
@@ -47,12 +81,24 @@ uint bmap(struct inode* ip, uint bn);
 void itrunc(struct inode* ip);
 void stati(struct inode* ip, struct stat* st);
 int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n);
+struct rastate;
+int readira(struct inode* ip, struct rastate* ra, int user_dst, uint64 dst, uint off, uint n);
 int writei(struct inode* ip, int user_src, uint64 src, uint off, uint n);
 struct inode* dirlookup(struct inode *dp, char *name, uint *poff);
 int dirlink(struct inode *dp, char *name, uint inum);
 int namecmp(const char *s, const char *t);
 struct inode* namei(char *path);
 struct inode* nameiparent(char *path, char *name);
+/* iosched */
+struct iostat;
+void iostat(struct iostat* st);
+/* log */
+struct superblock;
+void initlog(int dev, struct superblock* sb);
+void log_write(struct buf* b);
+void begin_op();
+void end_op();
+void log_sync();
 /* file */
 struct file;
 struct file* filedup(struct file* f);
@@ -33,10 +33,17 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the other threads would be left running in the old image.
+  if(p->leader != p || p->nthread > 0)
+    return -1;
+
+  begin_op();
+
   if((ip = namei(path)) == 0){
+    end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -68,6 +75,7 @@ exec(char *path, char **argv)
       goto bad;
   }
   iunlockput(ip);
+  end_op();
   ip = 0;
 
   p = myproc();
@@ -124,7 +132,12 @@ exec(char *path, char **argv)
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  fpu_exec(p);
   proc_freepagetable(oldpagetable, oldsz);
+  if(p->ring){
+    kfree(p->ring);
+    p->ring = 0;
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -133,6 +146,7 @@ exec(char *path, char **argv)
     proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
+    end_op();
   }
   return -1;
 }
@@ -0,0 +1,110 @@
+//
+// minimal flattened device tree reader.
+// qemu passes the address of the tree in a1 at boot;
+// start() uses this to find the timebase frequency,
+// the isa string and the kernel command line.
+// runs in machine mode before paging, so it must not
+// allocate, print or take locks.
+//
+
+#include "types.h"
+#include "string.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+#define MAXDEPTH 8
+
+// the tree is stored big-endian.
+uint32
+be32(void *p)
+{
+  uchar *b = p;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// does node name (e.g. "cpu@0") match path element s (up
+// to the next '/')? an element without a unit address
+// matches any unit address.
+static int
+namematch(char *s, char *name)
+{
+  while(*s && *s != '/' && *s == *name){
+    s++;
+    name++;
+  }
+  if(*s && *s != '/')
+    return 0;
+  return *name == 0 || *name == '@';
+}
+
+// find property prop of the node at path (e.g. "/cpus/cpu@0").
+// returns a pointer to the value and sets *len, or 0.
+void*
+fdt_getprop(uint64 dtb, char *path, char *prop, int *len)
+{
+  char *elem[MAXDEPTH];
+  int nelem, depth, match;
+  uchar *p, *strings;
+  uint32 tok, plen;
+  char *s, *name;
+
+  if(dtb == 0 || be32((void*)dtb) != FDT_MAGIC)
+    return 0;
+
+  // split path into elements.
+  nelem = 0;
+  for(s = path; *s; ){
+    while(*s == '/')
+      s++;
+    if(*s == 0)
+      break;
+    if(nelem >= MAXDEPTH)
+      return 0;
+    elem[nelem++] = s;
+    while(*s && *s != '/')
+      s++;
+  }
+
+  p = (uchar*)dtb + be32((void*)(dtb + 8));
+  strings = (uchar*)dtb + be32((void*)(dtb + 12));
+  depth = -1;   // the root node is depth 0
+  match = 0;    // path elements matched so far
+  for(;;){
+    tok = be32(p);
+    p += 4;
+    switch(tok){
+    case FDT_BEGIN_NODE:
+      name = (char*)p;
+      p += (strlen(name) + 4) & ~3;
+      depth++;
+      if(depth > 0 && depth == match + 1 && match < nelem && namematch(elem[match], name))
+        match++;
+      break;
+    case FDT_END_NODE:
+      if(depth > 0 && depth == match)
+        match--;
+      depth--;
+      break;
+    case FDT_PROP:
+      plen = be32(p);
+      name = (char*)strings + be32(p + 4);
+      p += 8;
+      if(match == nelem && depth == nelem && strncmp(name, prop, 64) == 0){
+        if(len)
+          *len = plen;
+        return p;
+      }
+      p += (plen + 3) & ~3;
+      break;
+    case FDT_NOP:
+      break;
+    default:
+      return 0;
+    }
+  }
+}
@@ -5,33 +5,43 @@
 #include "proc.h"
 #include "utils.h"
 #include "defs.h"
+// unused files are kept on a free list, so filealloc() is O(1).
+// the lock covers only the list; ref counts are atomic.
 struct {
+    struct spinlock lock;
+    struct file* free;
     struct file files[NFILE];
 } ftable;
 
 struct devsw devsw[NDEV];
 void stati(struct inode* ip, struct stat* st);
 void fileinit()
-{}
+{
+    initlock(&ftable.lock, "ftable");
+    for (int i = NFILE - 1; i >= 0; i--) {
+        ftable.files[i].nextfree = ftable.free;
+        ftable.free = &ftable.files[i];
+    }
+}
 
 struct file* filealloc()
 {
-    for (int i = 0; i < NFILE; i++) {
-        if (ftable.files[i].ref != 0) {
-            continue;
-        }
-        ftable.files[i].ref = 1;
-        return &ftable.files[i];
+    struct file* f;
+    acquire(&ftable.lock);
+    if ((f = ftable.free) != 0) {
+        ftable.free = f->nextfree;
+        f->nextfree = 0;
+        f->ref = 1;
     }
-    return 0;
+    release(&ftable.lock);
+    return f;
 }
 
 struct file* filedup(struct file* f)
 {
-    if (f->ref < 1) {
+    if (__sync_fetch_and_add(&f->ref, 1) < 1) {
         panic("filedup\n");
     }
-    f->ref++;
     return f;
 }
 
@@ -43,7 +53,7 @@ int filestat(struct file* f, uint64 addr)
     struct stat st;
     
     if(f->type == FD_INODE || f->type == FD_DEVICE){
-        ilock(f->ip);
+        ilockshared(f->ip);
         stati(f->ip, &st);
         iunlock(f->ip);
         if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -69,9 +79,11 @@ int fileread(struct file* f, uint64 addr, int n)
         }
         r = devsw[f->major].read(1, addr, n);
     } else if (f->type == FD_INODE) {
-        if ((r = readi(f->ip, 1, addr, f->off, n)) > 0) {
+        ilockshared(f->ip);
+        if ((r = readira(f->ip, &f->ra, 1, addr, f->off, n)) > 0) {
             f->off += r;
         }
+        iunlock(f->ip);
     } else {
         panic("fileread");
     }
@@ -93,16 +105,23 @@ int filewrite(struct file* f, uint64 addr, int n)
         }
         ret = devsw[f->major].write(1, addr, n);
     } else if (f->type == FD_INODE) {
+        // write a few blocks at a time so each transaction
+        // fits in the log: i-node, indirect block, allocation
+        // blocks, and 2 blocks of slop for non-aligned writes.
         int i = 0;
-        int max = BSIZE * 8;
+        int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
         while (i < n) {
             int n1 = n - i;
             if (n1 > max) {
                 n1 = max;
             }
+            begin_op();
+            ilock(f->ip);
             if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0) {
                 f->off += r;
             }
+            iunlock(f->ip);
+            end_op();
             if (r != n1) {
                 break;
             }
@@ -121,15 +140,20 @@ void fileclose(struct file* f)
     if (f->ref < 1) {
         panic("filedup\n");
     }
-    if (--f->ref > 0) {
+    if (__sync_sub_and_fetch(&f->ref, 1) > 0) {
         return;
     }
     ff = *f;
-    f->ref = 0;
     f->type = FD_NONE;
+    acquire(&ftable.lock);
+    f->nextfree = ftable.free;
+    ftable.free = f;
+    release(&ftable.lock);
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+        begin_op();
         iput(ff.ip);
+        end_op();
     }
 }
@@ -5,6 +5,13 @@
 #include "sleeplock.h"
 #include "riscv.h"
 #include "fs.h"
+// sequential read-ahead state, see readahead() in fs.c.
+struct rastate {
+    uint next;                   // block a sequential reader reads next
+    uint end;                    // read-ahead issued up to here
+    uint win;                    // blocks to keep in flight ahead of the reader
+};
+
 struct file {
     enum {FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE} type;
     int ref;
@@ -13,7 +20,9 @@ struct file {
     struct pipe* pipe;
     struct inode* ip;
     uint off;
+    struct rastate ra;           // for reads through this file
     short major;
+    struct file* nextfree;       // on ftable.free while ref == 0
 };
 
 #define major(dev) ((dev) >> 16 & 0xFFFF)
@@ -23,10 +32,11 @@ struct file {
 struct inode {
     uint dev;
     uint inum;
-    int ref;
+    int ref;                     // atomic; 1 -> 0 only under the hash bucket lock
     int valid;
+    struct inode* next;          // hash chain while ref > 0, else itable.free
 
-    struct sleeplock lock;
+    struct rwlock lock;          // shared for lookups and reads
     short type;
     short major;
     short minor;
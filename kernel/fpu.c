@@ -0,0 +1,109 @@
+//
+// lazy floating point.
+// the 32 fp registers are not part of the trapframe or the
+// context. a hart's fp registers belong to whichever proc
+// last loaded them (c->fpowner), and sstatus.FS says whether
+// they may be used (Off), match that proc's saved copy
+// (Clean), or are newer than it (Dirty).
+//
+// switching away from a proc saves its registers only if
+// they are Dirty, and turns FS Off. the next proc's first
+// fp instruction then traps as illegal, and fpu_trap()
+// loads its registers, skipping the load if they are still
+// live on this hart.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "string.h"
+
+extern struct cpu cpus[N_CPU];
+void fpsave(struct fpstate* fp);
+void fprestore(struct fpstate* fp);
+
+static void setfs(uint64 fs)
+{
+    w_sstatus((r_sstatus() & ~SSTATUS_FS) | fs);
+}
+
+// write the live registers back to p if they are newer.
+// caller has interrupts off.
+static void fpu_flush(struct proc* p)
+{
+    if ((r_sstatus() & SSTATUS_FS) == SSTATUS_FS_DIRTY) {
+        fpsave(&p->fp);
+        setfs(SSTATUS_FS_CLEAN);
+    }
+}
+
+// user fp starts Off on each hart; nothing is live yet.
+void fpuinit()
+{
+    setfs(SSTATUS_FS_OFF);
+    mycpu()->fpowner = 0;
+}
+
+// p is giving up the hart, from sched().
+void fpu_switchout(struct proc* p)
+{
+    fpu_flush(p);
+    setfs(SSTATUS_FS_OFF);
+}
+
+// an illegal instruction trap from p in user mode. if fp was
+// Off, it was probably an fp instruction: load p's registers,
+// turn FS on and return 1 so the instruction is retried.
+// if it traps again with FS on, it really was illegal.
+int fpu_trap(struct proc* p)
+{
+    struct cpu* c = mycpu();
+
+    if ((r_sstatus() & SSTATUS_FS) != SSTATUS_FS_OFF) {
+        return 0;
+    }
+    setfs(SSTATUS_FS_CLEAN);
+    if (c->fpowner != p || p->fpcpu != cpuid()) {
+        fprestore(&p->fp);
+        c->fpowner = p;
+        p->fpcpu = cpuid();
+    }
+    return 1;
+}
+
+// give np a copy of p's fp state, for fork() and clone().
+void fpu_fork(struct proc* p, struct proc* np)
+{
+    push_off();
+    fpu_flush(p);
+    pop_off();
+    np->fp = p->fp;
+    np->fpcpu = -1;
+}
+
+// a fresh image starts with zeroed fp registers.
+void fpu_exec(struct proc* p)
+{
+    push_off();
+    memset(&p->fp, 0, sizeof(p->fp));
+    if (mycpu()->fpowner == p) {
+        mycpu()->fpowner = 0;
+    }
+    setfs(SSTATUS_FS_OFF);
+    pop_off();
+}
+
+// p is being freed: no hart may think its registers are live,
+// or a new proc in the same slot could skip its load.
+void fpu_free(struct proc* p)
+{
+    for (int i = 0; i < N_CPU; i++) {
+        if (cpus[i].fpowner == p) {
+            cpus[i].fpowner = 0;
+        }
+    }
+    memset(&p->fp, 0, sizeof(p->fp));
+    p->fpcpu = -1;
+}
@@ -10,7 +10,10 @@
 struct superblock sb;
 struct buf* bread(uint dev, uint blockno);
 void brelse(struct buf *b);
-void bwrite(struct buf *b);
+void initlog(int dev, struct superblock* sb);
+void log_write(struct buf* b);
+void breadaheadv(uint dev, uint* blocks, int n);
+struct buf* breada(uint dev, uint blockno, uint rablock);
 static void readsb(int dev, struct superblock* sb)
 {
     struct buf* b = bread(dev, 1);
@@ -24,13 +27,14 @@ void fsinit(int dev)
     if (sb.magic != FSMAGIC) {
         panic("fsinit\n");
     }
+    initlog(dev, &sb);
 }
 
 void bzero(uint dev, uint blockno)
 {
     struct buf* b = bread(dev, blockno);
     memset(b->data, 0, sizeof(b->data));
-    bwrite(b);
+    log_write(b);
     brelse(b);
 }
 
@@ -44,7 +48,7 @@ int balloc(uint dev)
             m = 1 << (bi % 8);
             if ((bp->data[bi/8] & m) == 0) {
                 bp->data[bi/8] |= m;
-                bwrite(bp);
+                log_write(bp);
                 brelse(bp);
                 bzero(dev, b + bi);
                 return b + bi;
@@ -67,18 +71,44 @@ void bfree(uint dev, uint blockno)
         panic("bfree\n");
     }
     bp->data[bi / 8] &= ~m;
-    bwrite(bp);
+    log_write(bp);
     brelse(bp);
 }
 
+// in-use inodes are hashed by (dev, inum), one lock per
+// bucket, so lookups of different inodes don't contend.
+// an inode whose ref drops to 0 leaves its chain for the
+// free list, from which iget() allocates in O(1).
+// lock order: bucket lock, then itable.lock.
+#define NIHASH 13
+
+struct ibucket {
+    struct spinlock lock;
+    struct inode* head;
+};
+
 struct {
+    struct spinlock lock;        // protects free
+    struct inode* free;
+    struct ibucket hash[NIHASH];
     struct inode inode[NINODE];
 } itable;
 
+static struct ibucket* ibucket(uint dev, uint inum)
+{
+    return &itable.hash[(dev * 31 + inum) % NIHASH];
+}
+
 void iinit()
 {
-    for (uint inum = 0; inum < NINODE; inum++) {
-       initsleeplock(&itable.inode[inum].lock, "inode");
+    initlock(&itable.lock, "itable");
+    for (int i = 0; i < NIHASH; i++) {
+        initlock(&itable.hash[i].lock, "ihash");
+    }
+    for (int inum = NINODE - 1; inum >= 0; inum--) {
+       initrwlock(&itable.inode[inum].lock, "inode");
+       itable.inode[inum].next = itable.free;
+       itable.free = &itable.inode[inum];
     }
 }
 
@@ -88,12 +118,17 @@ struct inode* ialloc(uint dev, short type)
     struct buf* b;
     struct dinode* di;
     for (uint inum = 1; inum < sb.ninodes; inum++) {
-        b = bread(dev, IBLOCK(inum, sb));
+        // the scan goes block by block; fetch the next one early.
+        if (inum % IPB == 0 && inum + IPB < sb.ninodes) {
+            b = breada(dev, IBLOCK(inum, sb), IBLOCK(inum + IPB, sb));
+        } else {
+            b = bread(dev, IBLOCK(inum, sb));
+        }
         di = (struct dinode*)(b->data) + inum % IPB;
         if (di->type == 0) {
             memset((void*)di, 0, sizeof(struct dinode));
             di->type = type;
-            bwrite(b);
+            log_write(b);
             brelse(b);
             return iget(dev, inum);
         }
@@ -116,37 +151,43 @@ void iupdate(struct inode* ip)
     di->nlink = ip->nlink;
     di->size = ip->size;
     memmove((void*)di->addrs, (void*)ip->addrs, sizeof(di->addrs));
-    bwrite(b);
+    log_write(b);
     brelse(b);
 }
 
 struct inode* iget(uint dev, uint in)
 {
+    struct ibucket* b = ibucket(dev, in);
     struct inode* ip;
-    struct inode* empty = 0;
-    for (uint inum = 0; inum < NINODE; inum++) {
-        ip = &itable.inode[inum];
+    acquire(&b->lock);
+    for (ip = b->head; ip; ip = ip->next) {
         if (ip->dev == dev && ip->inum == in) {
-            ip->ref++;
+            __sync_fetch_and_add(&ip->ref, 1);
+            release(&b->lock);
             return ip;
         }
-        if (!empty && ip->ref == 0) {
-            empty = ip;
-        }
     }
-    if (empty == 0 ) {
+    acquire(&itable.lock);
+    if ((ip = itable.free) != 0) {
+        itable.free = ip->next;
+    }
+    release(&itable.lock);
+    if (ip == 0) {
         panic("iget\n");
     }
-    empty->dev = dev;
-    empty->inum = in;
-    empty->ref = 1;
-    empty->valid = 0;
-    return empty;
+    ip->dev = dev;
+    ip->inum = in;
+    ip->ref = 1;
+    ip->valid = 0;
+    ip->next = b->head;
+    b->head = ip;
+    release(&b->lock);
+    return ip;
 }
 
 struct inode* idup(struct inode* ip)
 {
-   ip->ref++;
+   __sync_fetch_and_add(&ip->ref, 1);
    return ip;
 }
 
@@ -157,7 +198,7 @@ void ilock(struct inode* ip)
     if (ip == 0 || ip->ref < 1) {
         panic("ilock\n");
     }
-    acquiresleep(&ip->lock);
+    acquirewrite(&ip->lock);
     if (ip->valid == 0) {
         b = bread(ip->dev, IBLOCK(ip->inum, sb));
         di = (struct dinode*)b->data + ip->inum % IPB;
@@ -175,25 +216,71 @@ void ilock(struct inode* ip)
     }
 }
 
+// release ip from ilock() or ilockshared().
 void iunlock(struct inode* ip)
 {
-    if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1) {
+    if(ip == 0 || (!holdingwrite(&ip->lock) && ip->lock.readers < 1) || ip->ref < 1) {
         panic("iunlock");
     }
-    releasesleep(&ip->lock);
+    releaserw(&ip->lock);
+}
+
+// lock ip for reading only: readi, stati and dirlookup.
+// the first lock after iget() loads the inode, which needs
+// the write lock.
+void ilockshared(struct inode* ip)
+{
+    if (ip == 0 || ip->ref < 1) {
+        panic("ilockshared\n");
+    }
+    if (ip->valid == 0) {
+        ilock(ip);
+        iunlock(ip);
+    }
+    acquireread(&ip->lock);
 }
 
 void itrunc(struct inode* ip);
 void iput(struct inode* ip)
 {
-    if(ip->ref == 1 && ip->valid && ip->nlink == 0){
-        acquiresleep(&ip->lock);
+    struct ibucket* b = ibucket(ip->dev, ip->inum);
+    struct inode** pp;
+
+    // no one else can find an inode with no links, so ref == 1
+    // under the bucket lock means it is ours alone: checked
+    // without the lock, two holders could each see the other's
+    // ref and neither would truncate.
+    acquire(&b->lock);
+    if (ip->ref == 1 && ip->valid && ip->nlink == 0) {
+        release(&b->lock);
+        acquirewrite(&ip->lock);
         ip->type = 0;
         itrunc(ip);
         iupdate(ip);
-        releasesleep(&ip->lock);
+        // ialloc() may hand out the inum again before we drop
+        // the ref; make its holder reload the inode.
+        ip->valid = 0;
+        releaserw(&ip->lock);
+        acquire(&b->lock);
+    }
+
+    // the last reference goes under the bucket lock, so a
+    // concurrent iget() either finds it still hashed with
+    // ref > 0 or not at all.
+    if (__sync_sub_and_fetch(&ip->ref, 1) == 0) {
+        for (pp = &b->head; *pp; pp = &(*pp)->next) {
+            if (*pp == ip) {
+                *pp = ip->next;
+                break;
+            }
+        }
+        ip->valid = 0;
+        acquire(&itable.lock);
+        ip->next = itable.free;
+        itable.free = ip;
+        release(&itable.lock);
     }
-    ip->ref--;
+    release(&b->lock);
 }
 
 
@@ -234,7 +321,7 @@ uint bmap(struct inode* ip, uint bn)
             addr = balloc(ip->dev);
             if (addr) {
                 a[bn] = addr;
-                bwrite(bp);
+                log_write(bp);
             }
         }
         brelse(bp);
@@ -282,7 +369,55 @@ void stati(struct inode* ip, struct stat* st)
     st->size = ip->size;
 }
 
-int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n)
+// sequential read-ahead. the state lives in the open file, so
+// readers of the same inode through different files don't
+// reset each other's windows. while reads land on the block
+// after the previous one, keep up to ra->win blocks read ahead
+// of the reader, doubling the window from RAMIN to RAMAX each
+// time the reader uses up half of it. a batch that reaches the
+// indirect block's range stops there and starts reading the
+// indirect block, so bmap() has it by the time the reader
+// gets there; the next batch maps the blocks through it.
+#define RAMIN 4
+#define RAMAX 32
+
+static void readahead(struct inode* ip, struct rastate* ra, uint bn)
+{
+    uint b, end, nblk = (ip->size + BSIZE - 1) / BSIZE;
+    uint blocks[RAMAX];
+    int n = 0;
+
+    if (bn + 1 == ra->next) {
+        // the same block again, e.g. the next dirent.
+        return;
+    }
+    if (bn != ra->next) {
+        // not sequential: start over.
+        ra->next = bn + 1;
+        ra->end = bn + 1;
+        ra->win = 0;
+        return;
+    }
+    ra->next = bn + 1;
+    if (ra->end > bn + ra->win / 2) {
+        return;
+    }
+    ra->win = ra->win ? min(ra->win * 2, RAMAX) : RAMIN;
+    end = min(bn + 1 + ra->win, nblk);
+    for (b = ra->end > bn + 1 ? ra->end : bn + 1; b < end; b++) {
+        if (b == NDIRECT && b > bn + 1) {
+            blocks[n++] = ip->addrs[NDIRECT];
+            break;
+        }
+        blocks[n++] = bmap(ip, b);
+    }
+    ra->end = b;
+    // a file laid out contiguously is read in one request.
+    breadaheadv(ip->dev, blocks, n);
+}
+
+// readi(), reading ahead with ra's state if it is not 0.
+int readira(struct inode* ip, struct rastate* ra, int user_dst, uint64 dst, uint off, uint n)
 {
     struct buf* bp;
     uint tot, m = 0;
@@ -293,6 +428,9 @@ int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n)
         n = ip->size - off;
     }
     for (tot = 0; tot < n; tot += m, off += m, dst += m) {
+        if (ra) {
+            readahead(ip, ra, off / BSIZE);
+        }
         uint addr = bmap(ip, off/BSIZE);
         if(addr == 0) {
             break;
@@ -309,6 +447,11 @@ int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n)
     return tot;
 }
 
+int readi(struct inode* ip, int user_dst, uint64 dst, uint off, uint n)
+{
+    return readira(ip, 0, user_dst, dst, off, n);
+}
+
 int writei(struct inode* ip, int user_src, uint64 src, uint off, uint n)
 {
     struct buf* bp;
@@ -331,7 +474,7 @@ int writei(struct inode* ip, int user_src, uint64 src, uint off, uint n)
             tot = -1;
             break;
         }
-        bwrite(bp);
+        log_write(bp);
         brelse(bp);
     }
     if(off > ip->size) {
@@ -450,10 +593,10 @@ static struct inode* namex(char* path, int nameiparent, char* name)
     if (*path == '/') {
         ip = iget(ROOTDEV, ROOTINO);
     } else {
-        ip = idup(myproc()->cwd);
+        ip = idup(myproc()->leader->cwd);
     }
     while ((path = skipelem(path, name)) != 0) {
-        ilock(ip);
+        ilockshared(ip);
         if (ip->type != T_DIR) {
             iunlockput(ip);
             return 0;
@@ -0,0 +1,127 @@
+//
+// futexes: block on a user memory word.
+// a waiter is keyed by the physical address of the word, so
+// threads and any other mappings of the page find each other.
+// waiters hang off a small hash table of buckets; a bucket's
+// lock covers its list and the check of the word's value, so
+// a futex_wake() between the check and the sleep is not lost.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 16
+
+struct futexbucket {
+    struct spinlock lock;
+    struct proc* head;   // waiters, linked by p->fnext
+};
+
+static struct futexbucket futexes[NFUTEX];
+
+void futexinit()
+{
+    for (int i = 0; i < NFUTEX; i++) {
+        initlock(&futexes[i].lock, "futex");
+    }
+}
+
+// physical address of the word at user va addr, or 0.
+static uint64 futexkey(struct proc* p, uint64 addr)
+{
+    uint64 pa;
+    if (addr % sizeof(int) != 0 || (pa = walkaddr(p->pagetable, addr)) == 0) {
+        return 0;
+    }
+    return pa + (addr & (PGSIZE - 1));
+}
+
+static struct futexbucket* futexbucket(uint64 key)
+{
+    return &futexes[(key >> 2) % NFUTEX];
+}
+
+// unlink p from b's wait list. caller holds b->lock.
+static void futexunlink(struct futexbucket* b, struct proc* p)
+{
+    struct proc** pp;
+    for (pp = &b->head; *pp; pp = &(*pp)->fnext) {
+        if (*pp == p) {
+            *pp = p->fnext;
+            break;
+        }
+    }
+    p->fnext = 0;
+    p->fkey = 0;
+}
+
+// sleep if the word at addr still holds val, until a futex_wake(),
+// time `when` (0 for none), or a kill. returns 0 when woken or
+// interrupted, 1 if the deadline passed, -1 if the word differs.
+int futex_wait(uint64 addr, int val, uint64 when)
+{
+    struct proc* p = myproc();
+    struct futexbucket* b;
+    uint64 key;
+    int cur, timedout = 0;
+
+    if ((key = futexkey(p, addr)) == 0) {
+        return -1;
+    }
+    b = futexbucket(key);
+    acquire(&b->lock);
+    if (copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) < 0 || cur != val) {
+        release(&b->lock);
+        return -1;
+    }
+    p->fkey = key;
+    p->fnext = b->head;
+    b->head = p;
+    if (when) {
+        timedout = sleep_until(&p->fkey, &b->lock, when);
+    } else {
+        sleep(&p->fkey, &b->lock);
+    }
+    // futex_wake() unlinks the waiters it wakes.
+    if (p->fkey) {
+        futexunlink(b, p);
+    }
+    release(&b->lock);
+    return timedout;
+}
+
+// wake up to n waiters on the word at addr; returns how many.
+int futex_wake(uint64 addr, int n)
+{
+    struct proc* p = myproc();
+    struct futexbucket* b;
+    struct proc** pp;
+    struct proc* w;
+    uint64 key;
+    int woken = 0;
+
+    if ((key = futexkey(p, addr)) == 0) {
+        return -1;
+    }
+    b = futexbucket(key);
+    acquire(&b->lock);
+    for (pp = &b->head; *pp && woken < n; ) {
+        w = *pp;
+        if (w->fkey != key) {
+            pp = &w->fnext;
+            continue;
+        }
+        *pp = w->fnext;
+        w->fnext = 0;
+        w->fkey = 0;
+        wakeup(&w->fkey);
+        woken++;
+    }
+    release(&b->lock);
+    return woken;
+}
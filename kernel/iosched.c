@@ -0,0 +1,328 @@
+//
+// I/O scheduler: the stage between the buffer cache and the
+// disk driver. virtio_disk_submit() queues requests here, and
+// the driver takes the next one whenever a queue's ring has
+// room and the policy allows another in flight. there is one
+// scheduler queue, with its own lock, per disk queue, so harts
+// submit without sharing a lock; requests are sorted and merged
+// within a queue. requests also complete here.
+//
+// a request is a run of bufs holding adjacent blocks, linked
+// through qnext, with its rq fields in the first buf. a new
+// request that continues or precedes a queued one going the
+// same way is merged into it, up to maxseg blocks.
+//
+// noop: one FIFO, dispatched as fast as the ring takes it.
+//
+// deadline: reads and writes wait in separate lists sorted by
+// block, and go in batches of up to NBATCH, sweeping up the
+// disk from the last block dispatched and wrapping at the top.
+// reads come first: a write batch starts only when no reads
+// wait, or when WSTARVED read batches in a row have run while
+// writes waited. a batch starts at its list's oldest request
+// if that has waited longer than READMS or WRITEMS, which
+// bounds how long any request can be passed over. at most
+// DEPTH requests are at the device, so the lists have
+// something to sort.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "proc.h"
+#include "virtio.h"
+#include "iostat.h"
+#include "utils.h"
+#include "string.h"
+
+#define NBATCH   8
+#define WSTARVED 2
+#define READMS   50
+#define WRITEMS  500
+#define DEPTH    4
+
+void bdone(struct buf *b);
+void virtio_disk_stat(struct iostat *st);
+
+extern int iosched;
+extern uint64 timebase;
+
+struct ioq;
+
+struct policy {
+  char *name;
+  int sorted;               // separate lists sorted by block, else one FIFO
+  int depth;                // most requests at the device
+  struct buf **(*next)(struct ioq *q); // link to the request to dispatch next, or 0
+};
+
+static struct buf **noop_next(struct ioq *q);
+static struct buf **deadline_next(struct ioq *q);
+
+static struct policy policies[] = {
+  { "noop", 0, NUM, noop_next },
+  { "deadline", 1, DEPTH, deadline_next },
+};
+
+// one scheduler queue per disk queue, each with its own lock,
+// so harts on different queues never share one.
+struct ioq {
+  struct spinlock lock;
+  struct buf *q[2];         // waiting requests, linked through rq.next
+  int inflight;
+
+  // deadline
+  int dir;                  // direction of the current batch
+  int batch;                // requests it may still dispatch
+  int starved;              // read batches started while writes waited
+  uint pos;                 // block after the last one dispatched
+
+  struct ioqstat st[2];
+};
+
+static struct policy *policy;
+static int maxseg;          // most blocks in one request
+static int nioq;
+static struct ioq ioqs[N_CPU];
+
+void
+iosched_init(int nq, int seg)
+{
+  if(iosched < 0 || iosched >= NELEM(policies))
+    iosched = IOSCHED;
+  policy = &policies[iosched];
+  maxseg = seg;
+  nioq = nq;
+  for(int i = 0; i < nq; i++)
+    initlock(&ioqs[i].lock, "iosched");
+}
+
+static struct buf**
+list(struct ioq *q, int write)
+{
+  return &q->q[policy->sorted ? write : 0];
+}
+
+// merge b into a waiting request that it continues or
+// precedes, if they go the same way and fit in one request.
+static int
+merge(struct ioq *q, struct buf *b)
+{
+  struct buf **pp, *r, *t;
+
+  for(pp = list(q, b->rq.write); (r = *pp) != 0; pp = &r->rq.next){
+    if(r->rq.write != b->rq.write || r->rq.async != b->rq.async ||
+       r->rq.n + b->rq.n > maxseg)
+      continue;
+    for(t = r; t->qnext; t = t->qnext)
+      ;
+    if(t->blockno + 1 == b->blockno){
+      t->qnext = b;
+      r->rq.n += b->rq.n;
+      return 1;
+    }
+    for(t = b; t->qnext; t = t->qnext)
+      ;
+    if(t->blockno + 1 == r->blockno){
+      // b takes r's place, and its age.
+      t->qnext = r;
+      b->rq.n += r->rq.n;
+      b->rq.queued = r->rq.queued;
+      b->rq.next = r->rq.next;
+      *pp = b;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// queue the request of n bufs starting at b, linked through
+// qnext, on scheduler queue qi. async requests complete
+// through bdone().
+void
+iosched_add(int qi, struct buf *b, int n, int write, int async)
+{
+  struct ioq *q = &ioqs[qi];
+  struct ioqstat *st = &q->st[write];
+  struct buf **pp;
+
+  acquire(&q->lock);
+  b->rq.q = qi;
+  b->rq.n = n;
+  b->rq.write = write;
+  b->rq.async = async;
+  b->rq.queued = r_time();
+  if(merge(q, b)){
+    st->merges++;
+  } else {
+    pp = list(q, write);
+    if(policy->sorted){
+      while(*pp && (*pp)->blockno < b->blockno)
+        pp = &(*pp)->rq.next;
+    } else {
+      while(*pp)
+        pp = &(*pp)->rq.next;
+    }
+    b->rq.next = *pp;
+    *pp = b;
+    if(++st->queued > st->maxqueued)
+      st->maxqueued = st->queued;
+  }
+  release(&q->lock);
+}
+
+// take the next request to dispatch from queue qi, if the
+// policy allows another at the device and it has at most
+// room blocks.
+struct buf*
+iosched_next(int qi, int room)
+{
+  struct ioq *q = &ioqs[qi];
+  struct buf **pp, *b = 0;
+
+  acquire(&q->lock);
+  if(q->inflight < policy->depth && (pp = policy->next(q)) != 0 &&
+     (*pp)->rq.n <= room){
+    b = *pp;
+    *pp = b->rq.next;
+    q->inflight++;
+    q->st[b->rq.write].queued--;
+    q->st[b->rq.write].inflight++;
+    q->pos = b->blockno + b->rq.n;
+    if(q->batch > 0)
+      q->batch--;
+  }
+  release(&q->lock);
+  return b;
+}
+
+// the device has finished the request starting at b: count
+// it, and hand its bufs back.
+void
+iosched_done(struct buf *b)
+{
+  struct ioq *q = &ioqs[b->rq.q];
+  struct ioqstat *st = &q->st[b->rq.write];
+  int async = b->rq.async;
+  struct buf *nb;
+  uint64 us;
+  int i;
+
+  acquire(&q->lock);
+  q->inflight--;
+  st->inflight--;
+  st->reqs++;
+  st->blocks += b->rq.n;
+  us = (r_time() - b->rq.queued) * 1000000 / timebase;
+  for(i = 0; i < NIOHIST - 1 && us >= 2; i++)
+    us >>= 1;
+  st->hist[i]++;
+  for(; b; b = nb){
+    nb = b->qnext;
+    acquire(&b->lock.lock);
+    b->disk = 0;   // disk is done with buf
+    wakeup(b);
+    release(&b->lock.lock);
+    if(async)
+      bdone(b);
+  }
+  release(&q->lock);
+}
+
+// wait for the disk to finish with b. the spinlock inside b's
+// sleeplock guards the end of b->disk, so a waiter needn't know
+// which queue the request went to, nor share a lock with
+// waiters for other bufs.
+void
+iosched_wait(struct buf *b)
+{
+  acquire(&b->lock.lock);
+  while(b->disk)
+    sleep(b, &b->lock.lock);
+  release(&b->lock.lock);
+}
+
+// the counters of all the queues, summed, and the driver's.
+void
+iostat(struct iostat *st)
+{
+  struct ioqstat *a, *b;
+  int d, i, j;
+
+  memset(st, 0, sizeof(*st));
+  safestrcpy(st->sched, policy->name, sizeof(st->sched));
+  for(i = 0; i < nioq; i++){
+    acquire(&ioqs[i].lock);
+    for(d = 0; d < 2; d++){
+      a = &st->q[d];
+      b = &ioqs[i].st[d];
+      a->reqs += b->reqs;
+      a->blocks += b->blocks;
+      a->merges += b->merges;
+      a->queued += b->queued;
+      if(b->maxqueued > a->maxqueued)
+        a->maxqueued = b->maxqueued;
+      a->inflight += b->inflight;
+      for(j = 0; j < NIOHIST; j++)
+        a->hist[j] += b->hist[j];
+    }
+    release(&ioqs[i].lock);
+  }
+  virtio_disk_stat(st);
+}
+
+static struct buf**
+noop_next(struct ioq *q)
+{
+  return q->q[0] ? &q->q[0] : 0;
+}
+
+// the first request in list dir at or above block pos.
+static struct buf**
+above(struct ioq *q, int dir, uint pos)
+{
+  struct buf **pp;
+
+  for(pp = &q->q[dir]; *pp; pp = &(*pp)->rq.next)
+    if((*pp)->blockno >= pos)
+      return pp;
+  return 0;
+}
+
+static struct buf**
+deadline_next(struct ioq *q)
+{
+  struct buf *b, *old;
+  uint64 ms;
+  int dir;
+
+  if(q->batch == 0 || above(q, q->dir, q->pos) == 0){
+    // start a new batch.
+    if(q->q[IO_READ] && (q->q[IO_WRITE] == 0 || q->starved < WSTARVED)){
+      dir = IO_READ;
+      if(q->q[IO_WRITE])
+        q->starved++;
+    } else if(q->q[IO_WRITE]){
+      dir = IO_WRITE;
+      q->starved = 0;
+    } else {
+      return 0;
+    }
+    q->dir = dir;
+    q->batch = NBATCH;
+    old = q->q[dir];
+    for(b = old; b; b = b->rq.next)
+      if(b->rq.queued < old->rq.queued)
+        old = b;
+    ms = dir == IO_READ ? READMS : WRITEMS;
+    if(r_time() - old->rq.queued > ms * timebase / 1000)
+      q->pos = old->blockno;
+    else if(above(q, dir, q->pos) == 0)
+      q->pos = 0;
+  }
+  return above(q, q->dir, q->pos);
+}
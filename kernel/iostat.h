@@ -0,0 +1,30 @@
+#ifndef _IOSTAT_H_
+#define _IOSTAT_H_
+#include "types.h"
+
+#define IO_READ  0
+#define IO_WRITE 1
+#define NIOHIST  20
+
+// counters for one direction of the disk's I/O scheduler.
+struct ioqstat {
+  uint64 reqs;     // requests completed
+  uint64 blocks;   // blocks they moved
+  uint64 merges;   // requests merged into one already queued
+  uint64 queued;   // requests waiting now
+  uint64 maxqueued;
+  uint64 inflight; // requests at the device now
+  uint64 hist[NIOHIST]; // completed [2^i, 2^(i+1)) us after queueing
+};
+
+struct iostat {
+  char sched[16];       // policy name
+  struct ioqstat q[2];  // IO_READ, IO_WRITE, summed over the queues
+  int nqueue;           // disk queues in use
+  int indirect;         // requests use indirect descriptors
+  int eventidx;         // notifies and interrupts use event indices
+  uint64 notifies;      // times the driver notified the device
+  uint64 intrs;         // disk interrupts
+};
+
+#endif
@@ -2,12 +2,14 @@
 #include "memlayout.h"
 #include "utils.h"
 extern char end[];
+int bshrink(int n);
 struct run {
     struct run* next;
 };
 
 struct {
     struct run head;
+    uint64 nfree;
 } klist;
 
 void freerange(void* pa_start, void* pa_end)
@@ -16,6 +18,7 @@ void freerange(void* pa_start, void* pa_end)
         struct run* p = (struct run*)i;
         p->next = klist.head.next;
         klist.head.next = p;
+        klist.nfree++;
     }
 }
 
@@ -28,10 +31,15 @@ void kinit()
 void* kalloc()
 {
     struct run* free = klist.head.next;
+    // out of memory: ask the buffer cache for a page back.
+    if (!free && bshrink(1) > 0) {
+        free = klist.head.next;
+    }
     if (!free) {
         return 0;
     }
     klist.head.next = free->next;
+    klist.nfree--;
     return (void*)free;
 }
 
@@ -43,4 +51,10 @@ void kfree(void* pa)
     struct run* free = (struct run*)pa;
     free->next = klist.head.next;
     klist.head.next = free;
+    klist.nfree++;
+}
+
+uint64 kfreepages()
+{
+    return klist.nfree;
 }
\ No newline at end of file
@@ -4,5 +4,6 @@
 void kinit();
 void* kalloc();
 void kfree(void* pa);
+uint64 kfreepages();
 
 #endif
\ No newline at end of file
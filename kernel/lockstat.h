@@ -0,0 +1,13 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+#include "types.h"
+// per-name spinlock statistics, kept when the kernel is
+// built with LOCKSTAT=1. times are in timebase ticks.
+struct lockstat {
+    char name[16];
+    uint64 acquires;   // acquire() calls
+    uint64 contended;  // acquire() calls that had to wait
+    uint64 spin;       // total time spent waiting
+    uint64 maxhold;    // longest time between acquire and release
+};
+#endif
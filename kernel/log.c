@@ -0,0 +1,327 @@
+//
+// write-ahead log for file system metadata and data.
+// a system call brackets its writes with begin_op()/end_op()
+// and calls log_write() instead of bwrite(). blocks stay
+// pinned in the buffer cache until the transaction commits.
+//
+// commit: copy the modified blocks into the log region in one
+// sequential pass, write the header (the commit point), then
+// install the blocks at their home locations and clear the
+// header. fsinit() replays a committed log left by a crash.
+//
+// delayed commit: end_op() does not write anything. the open
+// transaction collects the blocks of every operation until the
+// flusher thread commits it, COMMITMS after its first write,
+// or until the log is nearly full, or until fsync()/sync()
+// asks. the dirty blocks stay pinned in the buffer cache
+// meanwhile, and a block written by many operations is logged
+// and written home only once (absorption). a crash loses at
+// most the last COMMITMS of operations, never consistency.
+//
+// on-disk format:
+//   header block, containing block #s for block A, B, C, ...
+//   block A
+//   block B
+//   ...
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "proc.h"
+#include "utils.h"
+#include "string.h"
+#include "defs.h"
+
+void bpin(struct buf* b);
+void bunpin(struct buf* b);
+
+struct logheader {
+    int n;
+    int block[LOGSIZE];
+};
+
+struct {
+    struct spinlock lock;
+    int start;
+    int size;
+    int outstanding;    // how many FS sys calls are executing
+    int committing;     // in commit(), please wait
+    int want;           // commit as soon as outstanding drops to 0
+    int seq;            // number of commits done
+    uint64 opened;      // r_time() of the open transaction's first write
+    int dev;
+    struct logheader lh;
+} log;
+
+static void recover_from_log();
+static void commit();
+static void flusher();
+
+void initlog(int dev, struct superblock* sb)
+{
+    if (sizeof(struct logheader) >= BSIZE) {
+        panic("initlog: too big logheader");
+    }
+    initlock(&log.lock, "log");
+    log.start = sb->logstart;
+    log.size = sb->nlog;
+    log.dev = dev;
+    recover_from_log();
+    if (kthread(flusher, "flush") < 0) {
+        panic("initlog: flusher");
+    }
+}
+
+// copy committed blocks from log to their home location.
+// all the writes are queued before waiting for any, and runs
+// of adjacent home blocks go as one request.
+static void install_trans(int recovering)
+{
+    struct buf* dbuf[LOGSIZE];
+    int tail;
+
+    for (tail = 0; tail < log.lh.n; tail++) {
+        struct buf* lbuf = bread(log.dev, log.start + tail + 1);
+        dbuf[tail] = bread(log.dev, log.lh.block[tail]);
+        memmove(dbuf[tail]->data, lbuf->data, BSIZE);
+        brelse(lbuf);
+    }
+    bsubmitv(dbuf, log.lh.n, 1);
+    for (tail = 0; tail < log.lh.n; tail++) {
+        bwait(dbuf[tail]);
+        if (!recovering) {
+            dbuf[tail]->dirty = 0;
+            bunpin(dbuf[tail]);
+        }
+        brelse(dbuf[tail]);
+    }
+}
+
+// read the log header from disk into the in-memory log header
+static void read_head()
+{
+    struct buf* buf = bread(log.dev, log.start);
+    struct logheader* lh = (struct logheader*)(buf->data);
+    log.lh.n = lh->n;
+    for (int i = 0; i < log.lh.n; i++) {
+        log.lh.block[i] = lh->block[i];
+    }
+    brelse(buf);
+}
+
+// write the in-memory log header to disk.
+// this is the point at which the transaction commits.
+static void write_head()
+{
+    struct buf* buf = bread(log.dev, log.start);
+    struct logheader* hb = (struct logheader*)(buf->data);
+    hb->n = log.lh.n;
+    for (int i = 0; i < log.lh.n; i++) {
+        hb->block[i] = log.lh.block[i];
+    }
+    bwrite(buf);
+    brelse(buf);
+}
+
+static void recover_from_log()
+{
+    read_head();
+    install_trans(1);
+    log.lh.n = 0;
+    write_head();
+}
+
+// commit the open transaction. called with log.lock held
+// and no operations outstanding; returns with it held.
+static void commit_locked()
+{
+    log.committing = 1;
+    log.want = 0;
+    // commit() sleeps on disk i/o, so drop the lock.
+    release(&log.lock);
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    log.seq++;
+    wakeup(&log);
+}
+
+// called at the start of each FS system call.
+void begin_op()
+{
+    acquire(&log.lock);
+    while (1) {
+        if (log.committing) {
+            sleep(&log, &log.lock);
+        } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > log.size - 1) {
+            // this op might exhaust log space; wait for commit.
+            log.want = 1;
+            sleep(&log, &log.lock);
+        } else {
+            log.outstanding += 1;
+            release(&log.lock);
+            break;
+        }
+    }
+}
+
+// called at the end of each FS system call. commits only if
+// someone is waiting for it or the next op might not fit;
+// otherwise the flusher commits later.
+void end_op()
+{
+    acquire(&log.lock);
+    log.outstanding -= 1;
+    if (log.committing) {
+        panic("log.committing");
+    }
+    if (log.outstanding == 0 && log.lh.n > 0 &&
+        (log.want || log.lh.n + MAXOPBLOCKS > log.size - 1)) {
+        commit_locked();
+    } else {
+        // begin_op() may be waiting for log space,
+        // and decrementing log.outstanding has decreased
+        // the amount of reserved space.
+        wakeup(&log);
+    }
+    release(&log.lock);
+}
+
+// wait until everything logged so far is on disk.
+void log_sync()
+{
+    acquire(&log.lock);
+    // our writes are in the commit in progress, if any, since
+    // commits start only with no ops outstanding; otherwise
+    // they are in the open transaction.
+    int target = log.seq + 1;
+    if (!log.committing && log.lh.n == 0) {
+        target = log.seq;
+    }
+    while (log.seq < target) {
+        if (!log.committing && log.outstanding == 0) {
+            commit_locked();
+        } else {
+            log.want = 1;
+            sleep(&log, &log.lock);
+        }
+    }
+    release(&log.lock);
+}
+
+// kernel thread: commit the open transaction once it is
+// COMMITMS old. log_write() wakes it on a transaction's
+// first block.
+static void flusher()
+{
+    extern uint64 timebase;
+    uint64 when;
+
+    release(&myproc()->lock);
+    acquire(&log.lock);
+    while (1) {
+        if (log.lh.n == 0 || log.committing) {
+            sleep(&log.opened, &log.lock);
+            continue;
+        }
+        when = log.opened + COMMITMS * timebase / 1000;
+        if (r_time() < when) {
+            sleep_until(&log.opened, &log.lock, when);
+        } else if (log.outstanding > 0) {
+            // let the last op out commit it.
+            log.want = 1;
+            sleep(&log.opened, &log.lock);
+        } else {
+            commit_locked();
+        }
+    }
+}
+
+// copy modified blocks from cache to log, in log order,
+// with all the writes in flight at once.
+static void write_log()
+{
+    struct buf* to[LOGSIZE];
+    int tail;
+
+    for (tail = 0; tail < log.lh.n; tail++) {
+        to[tail] = bread(log.dev, log.start + tail + 1);
+        struct buf* from = bread(log.dev, log.lh.block[tail]);
+        memmove(to[tail]->data, from->data, BSIZE);
+        brelse(from);
+    }
+    // the log is contiguous, so this is one or two requests.
+    bsubmitv(to, log.lh.n, 1);
+    for (tail = 0; tail < log.lh.n; tail++) {
+        bwait(to[tail]);
+        brelse(to[tail]);
+    }
+}
+
+// sort the logged block numbers, so the log is written and
+// installed in ascending disk order.
+static void sort_log()
+{
+    for (int i = 1; i < log.lh.n; i++) {
+        int b = log.lh.block[i];
+        int j = i;
+        for (; j > 0 && log.lh.block[j - 1] > b; j--) {
+            log.lh.block[j] = log.lh.block[j - 1];
+        }
+        log.lh.block[j] = b;
+    }
+}
+
+static void commit()
+{
+    if (log.lh.n > 0) {
+        sort_log();
+        write_log();
+        write_head();
+        install_trans(0);
+        log.lh.n = 0;
+        write_head();
+    }
+}
+
+// caller has modified b->data and is done with the buffer.
+// record the block number and pin in the cache by bumping
+// refcnt; commit()/write_log() will do the disk write.
+// replaces bwrite(); a typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void log_write(struct buf* b)
+{
+    int i;
+
+    acquire(&log.lock);
+    if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) {
+        panic("too big a transaction");
+    }
+    if (log.outstanding < 1) {
+        panic("log_write outside of trans");
+    }
+
+    for (i = 0; i < log.lh.n; i++) {
+        if (log.lh.block[i] == b->blockno) {   // log absorption
+            break;
+        }
+    }
+    log.lh.block[i] = b->blockno;
+    b->dirty = 1;
+    if (i == log.lh.n) {  // add new block to log?
+        bpin(b);
+        if (log.lh.n++ == 0) {
+            log.opened = r_time();
+            wakeup(&log.opened);
+        }
+    }
+    release(&log.lock);
+}
@@ -10,13 +10,25 @@ void virtio_disk_init(void);
 void plicinit(void);
 void plicinithart(void);
 void consoleinit(void);
+void timerinit();
+void futexinit();
+void iinit();
+void fpuinit();
+void fileinit();
 void main()
 {
     kinit();
     kvminit(); // switch to kernelpagetable
+    // let user code read the time csr, for clock_ns().
+    w_scounteren(r_scounteren() | 2);
+    fpuinit();
     procinit();
+    timerinit();
+    futexinit();
     w_stvec((uint64)kernelvec);
     binit();
+    iinit();
+    fileinit();
     plicinit();
     plicinithart();
     virtio_disk_init();
@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt (ipi)
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +63,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   THREADFRAME(i) (p->trapframe of clone()d threads)
+//   RING (syscall rings, if ring_setup() was called, see ring.h)
+//   VDSO (p->vdso, read-only clock page, see vdso.h)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
\ No newline at end of file
+#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VDSO (TRAPFRAME - PGSIZE)
+#define RING (VDSO - PGSIZE)
+
+// trapframes of clone()d threads, which share their leader's
+// page table, below RING; one slot per proc table entry.
+#define THREADFRAME(i) (RING - ((i)+1)*PGSIZE)
\ No newline at end of file
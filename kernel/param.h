@@ -1,8 +1,9 @@
 #ifndef _PARAM_H_
 #define _PARAM_H_
 
-#define N_PROC 10
+#define N_PROC 11  // processes, plus one slot for the log's flusher kthread
 #define N_CPU 1
+#define CPUMASK_ALL ((1UL << N_CPU) - 1)  // every hart, as an affinity mask
 #define NPIPE       100
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -12,7 +13,11 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*6)  // minimum size of disk block cache
+#define BCACHEFRAC   8     // the cache may grow to 1/BCACHEFRAC of free memory
+#define COMMITMS     30    // a transaction commits at most this long after its first write
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define TICKHZ       100   // default timer ticks per second; boot with tickhz=N
+#define IOSCHED      1     // disk scheduler, 0 noop or 1 deadline; boot with iosched=N
 #endif
@@ -8,6 +8,7 @@
 #include "string.h"
 #include "stat.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct proc procs[N_PROC];
 struct cpu cpus[N_CPU];
@@ -33,30 +34,151 @@ struct proc* myproc()
 uint64 allocpid()
 {
     static uint64 next_pid = 0;
-    return next_pid++;
+    return __sync_fetch_and_add(&next_pid, 1);
+}
+
+// pid -> proc, chained through p->pidnext. pid_lock
+// covers the chains; take it after any p->lock.
+#define NPIDHASH 32
+#define PIDHASH(pid) (&pidhash[(uint)(pid) % NPIDHASH])
+static struct proc* pidhash[NPIDHASH];
+static struct spinlock pid_lock;
+
+static void pidinsert(struct proc* p)
+{
+    struct proc** h = PIDHASH(p->pid);
+    acquire(&pid_lock);
+    p->pidnext = *h;
+    *h = p;
+    release(&pid_lock);
+}
+
+static void pidremove(struct proc* p)
+{
+    struct proc** pp;
+    acquire(&pid_lock);
+    for (pp = PIDHASH(p->pid); *pp; pp = &(*pp)->pidnext) {
+        if (*pp == p) {
+            *pp = p->pidnext;
+            break;
+        }
+    }
+    p->pidnext = 0;
+    release(&pid_lock);
+}
+
+// find the proc with pid and return it locked, or 0.
+// the slot may be freed and reused between dropping pid_lock
+// and taking p->lock, so the pid is checked again.
+static struct proc* findpid(int pid)
+{
+    struct proc* p;
+    acquire(&pid_lock);
+    for (p = *PIDHASH(pid); p; p = p->pidnext) {
+        if (p->pid == pid) {
+            break;
+        }
+    }
+    release(&pid_lock);
+    if (p == 0) {
+        return 0;
+    }
+    acquire(&p->lock);
+    if (p->pid != pid || p->status == UNUSED) {
+        release(&p->lock);
+        return 0;
+    }
+    return p;
 }
 
 void procinit()
 {
+    initlock(&pid_lock, "pid");
+    initlock(&wait_lock, "wait");
     for (int i = 0; i < N_PROC; i++) {
         procs[i].status = UNUSED;
         initlock(&procs[i].lock, "proc");
+        initsleeplock(&procs[i].ringlock, "ring");
+    }
+}
+
+// may p run on the calling hart?
+static int canrun(struct proc* p)
+{
+    return p->status == RUNNABLE && (p->cpumask & (1UL << cpuid()));
+}
+
+// unlocked peek used by the idle path; a stale answer
+// only costs one extra pass or one extra wfi.
+static int anyrunnable()
+{
+    for (int i = 0; i < N_PROC; i++) {
+        if (canrun(&procs[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// nothing to run: halt this hart in wfi until an interrupt
+// arrives, either from a device, the timer, or another hart's
+// kickidle(). the idle flag is published before the final
+// anyrunnable() check so a concurrent wakeup() either sees it
+// and sends an ipi, or we see its RUNNABLE proc.
+static void idle(struct cpu* c)
+{
+    uint64 t0;
+
+    intr_off();
+    c->idle = 1;
+    __sync_synchronize();
+    if (!anyrunnable()) {
+        timer_rearm();
+        t0 = r_time();
+        // wfi returns on a pending interrupt even with SIE clear;
+        // it is taken once intr_on() below re-enables interrupts.
+        asm volatile("wfi");
+        c->idle_time += r_time() - t0;
+        c->wakeups++;
+    }
+    c->idle = 0;
+    intr_on();
+}
+
+// send an ipi to one idle hart in mask, so that it
+// leaves wfi and picks up newly RUNNABLE work.
+void kickidle(uint64 mask)
+{
+    __sync_synchronize();
+    for (int i = 0; i < N_CPU; i++) {
+        if (&cpus[i] != mycpu() && cpus[i].idle && (mask & (1UL << i))) {
+            *(volatile uint32*)CLINT_MSIP(i) = 1;
+            return;
+        }
     }
 }
 
 void scheduler()
 {
-    mycpu()->proc = 0;
+    struct cpu* c = mycpu();
+    int found;
+
+    c->proc = 0;
+    c->start = r_time();
     while(1) {
         intr_on();
+        found = 0;
         for (int i = 0; i < N_PROC; i++) {
             acquire(&procs[i].lock);
-            if (procs[i].status != RUNNABLE) {
+            if (!canrun(&procs[i])) {
                 release(&procs[i].lock);
                 continue;
             }
+            found = 1;
             procs[i].status = RUNNING;
             mycpu()->proc = &procs[i];
+            timer_slice();
+            procs[i].tstamp = r_time();
             int intena = mycpu()->intena;
             int noff = mycpu()->noff;
             swtch(&cpus[cpuid()].con, &procs[i].context);
@@ -65,6 +187,9 @@ void scheduler()
             mycpu()->proc = 0;
             release(&procs[i].lock);
         }
+        if (!found) {
+            idle(c);
+        }
     }
 }
 
@@ -108,6 +233,12 @@ pagetable_t proc_pagetable(struct proc* proc)
         kfree((void*)ptl);
         return 0;
     }
+    if (mappages(ptl, VDSO, PGSIZE, (uint64)proc->vdso, PTE_R | PTE_U)) {
+        uvmunmap(ptl, TRAMPOLINE, 1, 0);
+        uvmunmap(ptl, TRAPFRAME, 1, 0);
+        kfree((void*)ptl);
+        return 0;
+    }
     return ptl;
 }
 
@@ -115,9 +246,41 @@ void proc_freepagetable(pagetable_t pgtl, uint64 sz)
 {
     uvmunmap(pgtl, TRAMPOLINE, 1, 0);
     uvmunmap(pgtl, TRAPFRAME, 1, 0);
+    uvmunmap(pgtl, VDSO, 1, 0);
+    if (walkaddr(pgtl, RING)) {
+        uvmunmap(pgtl, RING, 1, 0);
+    }
     uvmfree(pgtl, sz);
 }
 
+// fill in p's clock page. the clock fields never change
+// after boot; ticks is refreshed by vdsoupdate().
+static void vdsoinit(struct proc* p)
+{
+    extern uint64 timebase, boottime, tick_interval;
+    memset((char*)p->vdso, 0, PGSIZE);
+    p->vdso->pid = p->pid;
+    p->vdso->timebase = timebase;
+    p->vdso->boottime = boottime;
+    p->vdso->tick_interval = tick_interval;
+}
+
+// publish the current tick count to p's clock page, on the
+// way back to user space. seqlock write side: seq is odd while
+// ticks changes. a writer that finds seq odd leaves the update
+// to whoever is already doing it.
+void vdsoupdate(struct proc* p)
+{
+    struct vdso* v = p->vdso;
+    uint32 seq = v->seq;
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&v->seq, seq, seq + 1)) {
+        return;
+    }
+    v->ticks = (r_time() - v->boottime) / v->tick_interval;
+    __sync_synchronize();
+    v->seq = seq + 2;
+}
+
 int growproc(int n)
 {
     struct proc* p;
@@ -125,8 +288,11 @@ int growproc(int n)
     if (n == 0) {
         return 0;
     }
-    p = myproc();
+    p = myproc()->leader;
     if (n > 0) {
+        if (p->sz + n > THREADFRAME(N_PROC - 1)) {
+            return -1;
+        }
         newsz = uvmalloc(p->pagetable, p->sz, p->sz + n, PTE_W | PTE_R);
         if (newsz == 0) {
             return -1;
@@ -161,24 +327,35 @@ FOUND:
     }
     p->status = USED;
     p->pid = allocpid();
+    pidinsert(p);
     p->kstack = KSTACK(p - procs);
     p->sz = 0;
     p->trapframe = frame;
+    p->trapva = TRAPFRAME;
+    p->leader = p;
+    p->cpumask = CPUMASK_ALL;
     memset((char*)p->trapframe, 0, PGSIZE);
-
-    // An empty user page table
-    p->pagetable = proc_pagetable(p);
-    if (p->pagetable == 0) {
-        freeproc(p);
-        release(&p->lock);
-        return 0;
-    }
     memset((char*)&p->context, 0, sizeof(p->context));
     p->context.ra = (uint64)forkret;
     p->context.sp = p->kstack + PGSIZE;
     return p;
 }
 
+// give p an address space of its own: a clock page and an
+// empty user page table. a clone()d thread skips this and
+// borrows its leader's.
+static int procmm(struct proc* p)
+{
+    if ((p->vdso = kalloc()) == 0) {
+        return -1;
+    }
+    vdsoinit(p);
+    if ((p->pagetable = proc_pagetable(p)) == 0) {
+        return -1;
+    }
+    return 0;
+}
+
 void uvmfirst(pagetable_t pgtbl, unsigned char* initcode, uint64 sz)
 {
     if (sz > PGSIZE) {
@@ -195,7 +372,7 @@ void userinit()
     struct proc* p;
     p = allocproc();
     initproc = p;
-    if (p == 0) {
+    if (p == 0 || procmm(p) < 0) {
         panic("userinit\n");
     }
     uvmfirst(p->pagetable, initcode, sizeof(initcode));
@@ -209,24 +386,82 @@ void userinit()
     release(&p->lock);
 }
 
+// start a kernel thread running fn, which never returns.
+// it has no user memory and no parent; fn must first release
+// myproc()->lock, as forkret() does.
+int kthread(void (*fn)(), char* name)
+{
+    struct proc* p = allocproc();
+    if (p == 0) {
+        return -1;
+    }
+    p->context.ra = (uint64)fn;
+    safestrcpy(p->name, name, sizeof(p->name));
+    p->status = RUNNABLE;
+    release(&p->lock);
+    return p->pid;
+}
+
+// add the usage of reaped proc pp, and of everything it
+// reaped, to dst. caller holds wait_lock.
+static void ruadd(struct rusage* dst, struct proc* pp)
+{
+    dst->utime += pp->ru.utime + pp->cru.utime;
+    dst->stime += pp->ru.stime + pp->cru.stime;
+    dst->nvcsw += pp->ru.nvcsw + pp->cru.nvcsw;
+    dst->nivcsw += pp->ru.nivcsw + pp->cru.nivcsw;
+    dst->faults += pp->ru.faults + pp->cru.faults;
+    for (int i = 0; i < NSYSCALL; i++) {
+        dst->syscalls[i] += pp->ru.syscalls[i] + pp->cru.syscalls[i];
+    }
+}
+
+// push p onto a kids or zombies list. caller holds wait_lock.
+static void kidadd(struct proc** head, struct proc* p)
+{
+    p->sibling = *head;
+    if (*head) {
+        (*head)->psibling = &p->sibling;
+    }
+    *head = p;
+    p->psibling = head;
+}
+
+// take p off whichever list it is on. caller holds wait_lock.
+static void kiddel(struct proc* p)
+{
+    *p->psibling = p->sibling;
+    if (p->sibling) {
+        p->sibling->psibling = p->psibling;
+    }
+    p->sibling = 0;
+    p->psibling = 0;
+}
+
 int fork()
 {
     int i, pid;
     struct proc* np;
     struct proc* p = myproc();
+    struct proc* leader = p->leader;
     
     // Allocate process.
     if ((np = allocproc()) == 0) {
         return -1;
     }
+    if (procmm(np) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
 
     // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    if (uvmcopy(p->pagetable, np->pagetable, leader->sz) < 0) {
         freeproc(np);
         release(&np->lock);
         return -1;
     }
-    np->sz = p->sz;
+    np->sz = leader->sz;
 
     // Copy saved user register
     *(np->trapframe) = *(p->trapframe);
@@ -236,23 +471,27 @@ int fork()
 
     // increment reference counts on open file descriptors
     for (i =0; i < NOFILE; i++) {
-        if (p->ofile[i]) {
-            np->ofile[i] = filedup(p->ofile[i]);
+        if (leader->ofile[i]) {
+            np->ofile[i] = filedup(leader->ofile[i]);
         }
     }
-    np->cwd = idup(p->cwd);
+    np->cwd = idup(leader->cwd);
 
     safestrcpy(np->name, p->name, sizeof(p->name));
+    np->cpumask = p->cpumask;
+    fpu_fork(p, np);
     pid = np->pid;
     release(&np->lock);
 
     acquire(&wait_lock);
     np->parent = p;
+    kidadd(&p->kids, np);
     release(&wait_lock);
 
     acquire(&np->lock);
     np->status = RUNNABLE;
     release(&np->lock);
+    kickidle(np->cpumask);
 
     return pid;
 }
@@ -263,6 +502,9 @@ void sched()
     if (p->status == RUNNING) {
         panic("sched\n");
     }
+    // time off the cpu is no one's; scheduler() restarts the clock.
+    p->ru.stime += r_time() - p->tstamp;
+    fpu_switchout(p);
     int noff = mycpu()->noff;
     int intena = mycpu()->intena;
     swtch(&myproc()->context, &mycpu()->con);
@@ -274,6 +516,7 @@ void yield()
 {
     acquire(&myproc()->lock);
     myproc()->status = RUNNABLE;
+    myproc()->ru.nivcsw++;
     sched();
     release(&myproc()->lock);
 }
@@ -283,9 +526,31 @@ void freeproc(struct proc* p)
     if (p->trapframe) {
         kfree(p->trapframe);
     }
-    if (p->pagetable) {
-        proc_freepagetable(p->pagetable, p->sz);
+    if (p->leader && p->leader != p) {
+        // a thread: the address space is the leader's.
+        uvmunmap(p->pagetable, p->trapva, 1, 0);
+    } else {
+        if (p->pagetable) {
+            proc_freepagetable(p->pagetable, p->sz);
+        }
+        if (p->vdso) {
+            kfree(p->vdso);
+        }
+        if (p->ring) {
+            kfree(p->ring);
+        }
     }
+    p->ring = 0;
+    if (p->status != UNUSED) {
+        pidremove(p);
+    }
+    fpu_free(p);
+    memset(&p->ru, 0, sizeof(p->ru));
+    memset(&p->cru, 0, sizeof(p->cru));
+    p->vdso = 0;
+    p->leader = 0;
+    p->nthread = 0;
+    p->ustack = 0;
     p->status = UNUSED;
     p->xstatus = 0;
     p->sz = 0;
@@ -301,14 +566,156 @@ void reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = procs; pp < &procs[N_PROC]; pp++){
-    if(pp->parent == p){
+  while((pp = p->kids) != 0){
+    kiddel(pp);
+    pp->parent = initproc;
+    kidadd(&initproc->kids, pp);
+  }
+  if(p->zombies){
+    while((pp = p->zombies) != 0){
+      kiddel(pp);
       pp->parent = initproc;
-      wakeup(initproc);
+      kidadd(&initproc->zombies, pp);
     }
+    wakeup(initproc);
   }
 }
 
+// create a thread in the caller's group that starts at fcn(arg1, arg2)
+// on the one-page user stack at stack, sharing the leader's page
+// table, files and cwd. returns the thread's pid.
+int clone(uint64 fcn, uint64 arg1, uint64 arg2, uint64 stack)
+{
+    struct proc* np;
+    struct proc* p = myproc();
+    struct proc* leader = p->leader;
+    int pid;
+
+    if (stack % 16 != 0 || stack + PGSIZE < stack || stack + PGSIZE > leader->sz) {
+        return -1;
+    }
+    if ((np = allocproc()) == 0) {
+        return -1;
+    }
+    np->trapva = THREADFRAME(np - procs);
+    if (mappages(leader->pagetable, np->trapva, PGSIZE, (uint64)np->trapframe, PTE_R | PTE_W)) {
+        np->leader = 0;
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    np->pagetable = leader->pagetable;
+    np->vdso = leader->vdso;
+    np->ustack = stack;
+
+    // start at fcn with the caller's gp/tp; a thread that
+    // returns from fcn faults, so ulib's wrapper calls exit().
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fcn;
+    np->trapframe->a0 = arg1;
+    np->trapframe->a1 = arg2;
+    np->trapframe->sp = stack + PGSIZE;
+    np->trapframe->ra = 0;
+
+    safestrcpy(np->name, p->name, sizeof(p->name));
+    np->cpumask = p->cpumask;
+    fpu_fork(p, np);
+    pid = np->pid;
+    release(&np->lock);
+
+    // a thread's parent is always its leader, so join() in any
+    // thread of the group can find it and wait() never does.
+    acquire(&wait_lock);
+    np->leader = leader;
+    np->parent = leader;
+    leader->nthread++;
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    np->status = RUNNABLE;
+    release(&np->lock);
+    kickidle(np->cpumask);
+
+    return pid;
+}
+
+// wait for another thread of the caller's group to exit, copy
+// the stack it was clone()d with to addr, and return its pid.
+// returns -1 if there are no other threads.
+int join(uint64 addr)
+{
+    struct proc *pp;
+    struct proc *p = myproc();
+    struct proc *leader = p->leader;
+    int havethreads, pid;
+
+    acquire(&wait_lock);
+    for (;;) {
+        havethreads = 0;
+        for (pp = procs; pp < &procs[N_PROC]; pp++) {
+            if (pp->leader != leader || pp == leader || pp == p) {
+                continue;
+            }
+            acquire(&pp->lock);
+            havethreads = 1;
+            if (pp->status == ZOMBIE) {
+                pid = pp->pid;
+                if (addr != 0 && copyout(p->pagetable, addr, (char*)&pp->ustack, sizeof(pp->ustack)) < 0) {
+                    release(&pp->lock);
+                    release(&wait_lock);
+                    return -1;
+                }
+                ruadd(&leader->cru, pp);
+                freeproc(pp);
+                leader->nthread--;
+                release(&pp->lock);
+                release(&wait_lock);
+                return pid;
+            }
+            release(&pp->lock);
+        }
+        if (!havethreads || killed(p)) {
+            release(&wait_lock);
+            return -1;
+        }
+        // exiting threads wake their parent, the leader.
+        sleep(leader, &wait_lock);
+    }
+}
+
+// kill and reap every other thread in p's group, before p
+// releases the memory, files and cwd they share.
+static void killthreads(struct proc* p)
+{
+    struct proc* pp;
+
+    acquire(&wait_lock);
+    while (p->nthread > 0) {
+        for (pp = procs; pp < &procs[N_PROC]; pp++) {
+            if (pp->leader != p || pp == p) {
+                continue;
+            }
+            acquire(&pp->lock);
+            if (pp->status == ZOMBIE) {
+                ruadd(&p->cru, pp);
+                freeproc(pp);
+                p->nthread--;
+            } else {
+                pp->killed = 1;
+                if (pp->status == SLEEPING) {
+                    pp->status = RUNNABLE;
+                }
+            }
+            release(&pp->lock);
+        }
+        if (p->nthread > 0) {
+            kickidle(CPUMASK_ALL);
+            sleep(p, &wait_lock);
+        }
+    }
+    release(&wait_lock);
+}
+
 void exit(int xstatus)
 {
     // free proc
@@ -317,22 +724,34 @@ void exit(int xstatus)
         panic("init exiting");
     }
 
-    // Close all open files.
-    for(int fd = 0; fd < NOFILE; fd++){
-        if(p->ofile[fd]){
-        struct file *f = p->ofile[fd];
-        fileclose(f);
-        p->ofile[fd] = 0;
+    // only the leader owns the files and cwd; a thread
+    // just goes away and is reaped by join().
+    if (p->leader == p) {
+        killthreads(p);
+
+        // Close all open files.
+        for(int fd = 0; fd < NOFILE; fd++){
+            if(p->ofile[fd]){
+            struct file *f = p->ofile[fd];
+            fileclose(f);
+            p->ofile[fd] = 0;
+            }
         }
+        begin_op();
+        iput(p->cwd);
+        end_op();
+        p->cwd = 0;
     }
-    iput(p->cwd);
-    p->cwd = 0;
 
     acquire(&wait_lock);
     // Give any children to init.
     reparent(p);
 
     // Parent might be sleeping in wait().
+    if (p->leader == p) {
+        kiddel(p);
+        kidadd(&p->parent->zombies, p);
+    }
     wakeup(p->parent);
 
     acquire(&p->lock);
@@ -357,21 +776,94 @@ int killed(struct proc* p)
 int kill(uint64 pid)
 {
     struct proc* p;
-    for (int i = 0; i < N_PROC; i++) {
-        p = &procs[i];
-        if (p->pid == pid) {
-            // wakeup 之后应该立马判断是否被killed，是则退出进程
-            // killed 的判断时机，进程中断函数
-            acquire(&p->lock);
-            if (p->status == SLEEPING) {
-                p->status = RUNNABLE;
-            }
-            p->killed = 1;
-            release(&p->lock);
-            return 0;
+    if ((p = findpid(pid)) == 0) {
+        return -1;
+    }
+    // wakeup 之后应该立马判断是否被killed，是则退出进程
+    // killed 的判断时机，进程中断函数
+    if (p->status == SLEEPING) {
+        p->status = RUNNABLE;
+    }
+    p->killed = 1;
+    release(&p->lock);
+    kickidle(p->cpumask);
+    return 0;
+}
+
+// find the proc with pid, 0 for the caller, and return it locked.
+static struct proc* lockpid(int pid)
+{
+    struct proc* p;
+    if (pid == 0) {
+        p = myproc();
+        acquire(&p->lock);
+        return p;
+    }
+    return findpid(pid);
+}
+
+// restrict pid to the harts in mask. a proc moved off the
+// hart it is running on gives it up at once if it is the
+// caller, or at its next yield otherwise.
+int setaffinity(int pid, uint64 mask)
+{
+    struct proc* p;
+
+    mask &= CPUMASK_ALL;
+    if (mask == 0 || (p = lockpid(pid)) == 0) {
+        return -1;
+    }
+    p->cpumask = mask;
+    release(&p->lock);
+    kickidle(mask);
+    if (p == myproc() && !(mask & (1UL << cpuid()))) {
+        yield();
+    }
+    return 0;
+}
+
+int getaffinity(int pid, uint64* mask)
+{
+    struct proc* p;
+
+    if ((p = lockpid(pid)) == 0) {
+        return -1;
+    }
+    *mask = p->cpumask;
+    release(&p->lock);
+    return 0;
+}
+
+static char* statename[] = {
+[USED]      "used",
+[RUNNING]   "run",
+[RUNNABLE]  "runble",
+[SLEEPING]  "sleep",
+[ZOMBIE]    "zombie",
+};
+
+// print each process with its cpu time (ms), context switches
+// and system calls. runs on ctrl-p without locks, so it won't
+// wedge a stuck machine, at the cost of a racy snapshot.
+void procdump()
+{
+    extern uint64 timebase;
+    struct proc* p;
+    uint64 nsys;
+
+    printf("\npid state  name     user   sys   vcsw  ivcsw  faults syscalls\n");
+    for (p = procs; p < &procs[N_PROC]; p++) {
+        if (p->status == UNUSED) {
+            continue;
+        }
+        nsys = 0;
+        for (int i = 0; i < NSYSCALL; i++) {
+            nsys += p->ru.syscalls[i];
         }
+        printf("%d %s %s %d %d %d %d %d %d\n", p->pid, statename[p->status], p->name,
+               (int)(p->ru.utime * 1000 / timebase), (int)(p->ru.stime * 1000 / timebase),
+               (int)p->ru.nvcsw, (int)p->ru.nivcsw, (int)p->ru.faults, (int)nsys);
     }
-    return -1;
 }
 
 // Wait for a child process to exit and return its pid.
@@ -379,40 +871,34 @@ int kill(uint64 pid)
 int wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = procs; pp < &procs[N_PROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->status == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstatus,
-                                  sizeof(pp->xstatus)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    // exit() moved any exited children to p->zombies.
+    // threads are reaped by join(), not wait().
+    if((pp = p->zombies) != 0){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+      pid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstatus,
+                              sizeof(pp->xstatus)) < 0) {
         release(&pp->lock);
+        release(&wait_lock);
+        return -1;
       }
+      kiddel(pp);
+      ruadd(&p->cru, pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(p->kids == 0 || killed(p)){
       release(&wait_lock);
       return -1;
     }
@@ -426,8 +912,6 @@ void sleep(void* chan, struct spinlock* lk)
 {
     struct proc *p = myproc();
     acquire(&p->lock);
-    p->chan = chan;
-    p->status = SLEEPING;
     if (lk && !holding(lk)) {
         panic("sleep\n");
     }
@@ -435,7 +919,14 @@ void sleep(void* chan, struct spinlock* lk)
         release(lk);
     }
 
-    sched();
+    // a timer that already expired has nothing left to wake
+    // us, so don't sleep through it; see sleep_until().
+    if (!p->timedout) {
+        p->chan = chan;
+        p->status = SLEEPING;
+        p->ru.nvcsw++;
+        sched();
+    }
     if (lk) {
         acquire(lk);
     }
@@ -446,15 +937,20 @@ void sleep(void* chan, struct spinlock* lk)
 void wakeup(void* chan)
 {
     struct proc *p;
+    uint64 woken = 0;     // harts the woken procs may run on
     for (p = procs; p < &procs[N_PROC]; p++) {
         if (p != myproc()) {
             acquire(&p->lock);
             if (p->status == SLEEPING && p->chan == chan) {
                 p->status = RUNNABLE;
+                woken |= p->cpumask;
             }
             release(&p->lock);
         } 
     }
+    if (woken) {
+        kickidle(woken);
+    }
 }
 
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
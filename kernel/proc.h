@@ -3,6 +3,7 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "file.h"
+#include "rusage.h"
 struct context {
     uint64 ra;
     uint64 sp;
@@ -61,6 +62,12 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// user fp registers, saved lazily; see fpu.c.
+struct fpstate {
+    uint64 f[32];
+    uint64 fcsr;
+};
+
 enum procstate {
     USED,
     RUNNING,
@@ -73,17 +80,53 @@ enum procstate {
 struct proc {
     enum procstate status;
     int pid;
+    struct proc *pidnext;        // next in its pid hash chain, under pid_lock
     int xstatus;
     int killed;
     struct proc *parent;
     void *chan;
+    uint64 when;                 // timer deadline, in time csr ticks
+    int tidx;                    // position in the timer heap, 0 if unarmed
+    int timedout;                // timer expired since sleep_until() armed it
+    uint64 cpumask;              // harts it may run on, bit i for hart i
+    uint64 fkey;                 // futex_wait(): key of the word, 0 if not waiting
+    struct proc *fnext;          // next waiter in the futex bucket
+    // accounting, see rusage.h. written only by the proc itself,
+    // except that wait() and join() add reaped usage under wait_lock.
+    struct rusage ru;            // this proc's usage
+    struct rusage cru;           // usage of reaped children and threads
+    uint64 tstamp;               // r_time() when ru last caught up
+    struct proc *lknext;         // next waiter for a sleeplock or rwlock
+    int lkshared;                // waiting for a read hold
+    int lkgranted;               // the lock was handed to us
     struct spinlock lock;
 
+    // child lists, protected by wait_lock. a child is on its
+    // parent's kids list until it exits, then on zombies until
+    // wait() reaps it. threads are on neither.
+    struct proc *kids;           // live children
+    struct proc *zombies;        // exited children, not yet waited for
+    struct proc *sibling;        // next on the parent's kids or zombies list
+    struct proc **psibling;      // the pointer to us on that list
+
+    // thread group. a clone()d thread shares its leader's page
+    // table, sz, open files and cwd; use p->leader->sz etc.
+    // leader and nthread are protected by wait_lock.
+    struct proc *leader;         // group leader; p itself for a process
+    int nthread;                 // leader: threads in the group, not yet reaped
+    uint64 ustack;               // thread: user stack passed to clone()
+
     // these are private to the process, so p->lock need not be held.
     uint64 kstack;               // Virtual address of kernel stack
     uint64 sz;                   // Size of process memory (bytes)
     pagetable_t pagetable;       // User page table
     struct trapframe *trapframe; // data page for trampoline.S
+    uint64 trapva;               // user va of trapframe: TRAPFRAME, or THREADFRAME()
+    struct vdso *vdso;           // clock page mapped read-only at VDSO
+    struct ring *ring;           // leader: syscall rings mapped at RING, or 0
+    struct sleeplock ringlock;   // leader: serializes ring_enter() across threads
+    struct fpstate fp;           // fp registers, when not live on a hart
+    int fpcpu;                   // hart its fp registers were last loaded on
     struct context context;      // swtch() here to run process
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
@@ -96,6 +139,14 @@ struct cpu {
     struct proc* proc;
     int noff;
     int intena;
+    uint64 slice_end;            // time the running proc's slice expires
+    struct proc* fpowner;        // proc whose fp registers this hart holds
+
+    // idle accounting, in timebase ticks.
+    volatile int idle;           // halted in wfi, needs an ipi to notice work
+    uint64 start;                // r_time() when scheduler() started
+    uint64 idle_time;            // total time spent halted in wfi
+    uint64 wakeups;              // number of times wfi returned
 };
 
 /* switch from a to b*/
@@ -111,9 +162,14 @@ struct cpu* mycpu();
 struct proc* myproc();
 
 void userinit();
+int kthread(void (*fn)(), char* name);
 void procinit();
 void scheduler();
 void exit(int);
+int clone(uint64 fcn, uint64 arg1, uint64 arg2, uint64 stack);
+int join(uint64 addr);
+int setaffinity(int pid, uint64 mask);
+int getaffinity(int pid, uint64* mask);
 int growproc(int n);
 void wakeup(void* chan);
 int killed(struct proc* p);
@@ -121,6 +177,9 @@ int kill(uint64 pid);
 int setkilled(struct proc* p);
 void sleep(void* chan, struct spinlock* lk);
 void wakeup(void* chan);
+void kickidle(uint64 mask);
+void procdump();
+void vdsoupdate(struct proc* p);
 int either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 #endif
\ No newline at end of file
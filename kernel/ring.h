@@ -0,0 +1,39 @@
+#ifndef _RING_H_
+#define _RING_H_
+#include "types.h"
+#include "syscall.h"
+// batched system calls. ring_setup() maps one page, shared
+// by the process and the kernel, at RING (see memlayout.h).
+// the process fills submission entries and advances sq_tail;
+// ring_enter(n) runs up to n of them, through the ordinary
+// syscall table, and posts a completion for each.
+// heads and tails are free-running; index with % RING_ENTRIES.
+
+#define RING_ENTRIES 32
+
+// ops allowed in a submission entry, by SYS_ number.
+#define RING_OPS ((1 << SYS_read) | (1 << SYS_write) | (1 << SYS_open) | \
+                  (1 << SYS_close) | (1 << SYS_fstat))
+
+struct sqe {
+  int op;             // SYS_read, SYS_write, ...
+  int pad;
+  uint64 args[4];     // the syscall's arguments, as a0..a3
+  uint64 user_data;   // copied to the completion
+};
+
+struct cqe {
+  uint64 user_data;
+  long res;           // the syscall's return value
+};
+
+struct ring {
+  volatile uint32 sq_head;  // written by the kernel
+  volatile uint32 sq_tail;  // written by the process
+  volatile uint32 cq_head;  // written by the process
+  volatile uint32 cq_tail;  // written by the kernel
+  struct sqe sq[RING_ENTRIES];
+  struct cqe cq[RING_ENTRIES];
+};
+
+#endif
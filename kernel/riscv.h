@@ -45,6 +45,10 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_FS (3L << 13)  // fp unit state:
+#define SSTATUS_FS_OFF (0L << 13)   //   fp instructions trap
+#define SSTATUS_FS_CLEAN (2L << 13) //   registers match the saved copy
+#define SSTATUS_FS_DIRTY (3L << 13) //   registers were written since
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -259,6 +263,47 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+// Machine Environment Configuration (menvcfg).
+// STCE lets supervisor mode use the Sstc stimecmp csr.
+// csr numbers, since older assemblers lack the names.
+#define MENVCFG_STCE (1L << 63)
+static inline uint64
+r_menvcfg()
+{
+  uint64 x;
+  asm volatile("csrr %0, 0x30a" : "=r" (x) );
+  return x;
+}
+
+static inline void 
+w_menvcfg(uint64 x)
+{
+  asm volatile("csrw 0x30a, %0" : : "r" (x));
+}
+
+// Supervisor Timer Compare (Sstc extension); a supervisor
+// timer interrupt is pending while time >= stimecmp.
+static inline void 
+w_stimecmp(uint64 x)
+{
+  asm volatile("csrw 0x14d, %0" : : "r" (x));
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -0,0 +1,19 @@
+#ifndef _RUSAGE_H_
+#define _RUSAGE_H_
+#include "types.h"
+#include "syscall.h"
+
+#define RUSAGE_SELF     0   // the caller
+#define RUSAGE_CHILDREN 1   // its reaped children, and theirs
+
+// per-process resource usage. times are in timebase ticks.
+struct rusage {
+  uint64 utime;              // time in user mode
+  uint64 stime;              // time in the kernel on the process's behalf
+  uint64 nvcsw;              // voluntary context switches: sleeps
+  uint64 nivcsw;             // involuntary ones: preemptions and yields
+  uint64 faults;             // page faults
+  uint64 syscalls[NSYSCALL]; // calls, indexed by SYS_ number
+};
+
+#endif
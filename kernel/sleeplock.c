@@ -1,14 +1,50 @@
 #include "sleeplock.h"
 #include "spinlock.h"
+#include "param.h"
 #include "proc.h"
 #include "utils.h"
+
+// join q and sleep on our own p->lknext until a release
+// grants us the lock. caller holds lk, as for sleep().
+static void lockwait(struct lockq* q, struct spinlock* lk, int shared)
+{
+    struct proc* p = myproc();
+    p->lknext = 0;
+    p->lkshared = shared;
+    p->lkgranted = 0;
+    if (q->tail) {
+        q->tail->lknext = p;
+    } else {
+        q->head = p;
+    }
+    q->tail = p;
+    // a kill makes sleep() return early; keep waiting.
+    while (!p->lkgranted) {
+        sleep(&p->lknext, lk);
+    }
+}
+
+static struct proc* lockpop(struct lockq* q)
+{
+    struct proc* p = q->head;
+    if (p) {
+        q->head = p->lknext;
+        if (q->head == 0) {
+            q->tail = 0;
+        }
+        p->lknext = 0;
+        p->lkgranted = 1;
+    }
+    return p;
+}
+
 void initsleeplock(struct sleeplock* lk, char* name)
 {
     initlock(&lk->lock, name);
     lk->locked = 0;
     lk->name = name;
     lk->pid = 0; 
-    
+    lk->q.head = lk->q.tail = 0;
 }
 
 int holdingsleep(struct sleeplock* lk)
@@ -18,26 +54,118 @@ int holdingsleep(struct sleeplock* lk)
 
 void acquiresleep(struct sleeplock* lk)
 {
-    while (1) {
-        acquire(&lk->lock);
-        if (!lk->locked) {
-            lk->locked = 1;
-            lk->pid = myproc()->pid;
-            release(&lk->lock);
-            break;
-        }
-        sleep(lk, &lk->lock);
+    acquire(&lk->lock);
+    if (!lk->locked) {
+        lk->locked = 1;
+        lk->pid = myproc()->pid;
+    } else {
+        // releasesleep() sets locked and pid for us.
+        lockwait(&lk->q, &lk->lock, 0);
+    }
+    release(&lk->lock);
+}
+
+// take lk if it is free, without sleeping. returns 1 if so.
+int tryacquiresleep(struct sleeplock* lk)
+{
+    int ok = 0;
+    acquire(&lk->lock);
+    if (!lk->locked) {
+        lk->locked = 1;
+        lk->pid = myproc()->pid;
+        ok = 1;
     }
+    release(&lk->lock);
+    return ok;
 }
 
 void releasesleep(struct sleeplock* lk)
 {
+    struct proc* w;
     if (!holdingsleep(lk)) {
         panic("releasesleep\n");
     }
     acquire(&lk->lock);
-    lk->locked = 0;
-    lk->pid = 0;
+    if ((w = lockpop(&lk->q)) != 0) {
+        lk->pid = w->pid;
+    } else {
+        lk->locked = 0;
+        lk->pid = 0;
+    }
     release(&lk->lock);
-    wakeup(lk);
-}
\ No newline at end of file
+    if (w) {
+        wakeup(&w->lknext);
+    }
+}
+
+void initrwlock(struct rwlock* lk, char* name)
+{
+    initlock(&lk->lock, name);
+    lk->readers = 0;
+    lk->writer = 0;
+    lk->name = name;
+    lk->q.head = lk->q.tail = 0;
+}
+
+int holdingwrite(struct rwlock* lk)
+{
+    return lk->writer != 0 && lk->writer == myproc();
+}
+
+void acquirewrite(struct rwlock* lk)
+{
+    acquire(&lk->lock);
+    if (lk->writer == 0 && lk->readers == 0 && lk->q.head == 0) {
+        lk->writer = myproc();
+    } else {
+        lockwait(&lk->q, &lk->lock, 0);
+    }
+    release(&lk->lock);
+}
+
+void acquireread(struct rwlock* lk)
+{
+    acquire(&lk->lock);
+    if (lk->writer == 0 && lk->q.head == 0) {
+        lk->readers++;
+    } else {
+        lockwait(&lk->q, &lk->lock, 1);
+    }
+    release(&lk->lock);
+}
+
+// release a read or write hold. when the lock becomes free,
+// hand it to the first waiter, and if that is a reader, to
+// the readers queued directly behind it as well.
+void releaserw(struct rwlock* lk)
+{
+    struct proc* woken[N_PROC];
+    int n = 0;
+
+    acquire(&lk->lock);
+    if (lk->writer) {
+        if (lk->writer != myproc()) {
+            panic("releaserw\n");
+        }
+        lk->writer = 0;
+    } else if (lk->readers > 0) {
+        lk->readers--;
+    } else {
+        panic("releaserw\n");
+    }
+    if (lk->writer == 0 && lk->readers == 0 && lk->q.head) {
+        if (!lk->q.head->lkshared) {
+            woken[n] = lockpop(&lk->q);
+            lk->writer = woken[n++];
+        } else {
+            while (lk->q.head && lk->q.head->lkshared) {
+                woken[n++] = lockpop(&lk->q);
+                lk->readers++;
+            }
+        }
+    }
+    release(&lk->lock);
+    for (int i = 0; i < n; i++) {
+        wakeup(&woken[i]->lknext);
+    }
+}
@@ -1,14 +1,42 @@
 #ifndef _SLEEPLOCK_H_
 #define _SLEEPLOCK_H_
 #include "spinlock.h"
+// procs waiting for a sleeping lock, in arrival order,
+// linked by p->lknext. a release hands the lock straight
+// to the head instead of waking everyone to race for it.
+struct lockq {
+    struct proc* head;
+    struct proc* tail;
+};
+
 struct sleeplock {
     struct spinlock lock;
     uint locked;
     char* name;
     int pid;
+    struct lockq q;
+};
+
+// sleeping reader/writer lock: any number of readers, or one
+// writer. waiters are served in order, so a queued writer
+// holds back readers that arrive after it.
+struct rwlock {
+    struct spinlock lock;
+    int readers;     // shared holders
+    struct proc* writer; // exclusive holder, 0 if none
+    char* name;
+    struct lockq q;
 };
+
 void initsleeplock(struct sleeplock* lk, char* name);
 int holdingsleep(struct sleeplock* lk);
 void acquiresleep(struct sleeplock* lk);
+int tryacquiresleep(struct sleeplock* lk);
 void releasesleep(struct sleeplock* lk);
-#endif
\ No newline at end of file
+
+void initrwlock(struct rwlock* lk, char* name);
+void acquirewrite(struct rwlock* lk);
+void acquireread(struct rwlock* lk);
+void releaserw(struct rwlock* lk);
+int holdingwrite(struct rwlock* lk);
+#endif
@@ -1,23 +1,110 @@
 #include "riscv.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
 #include "types.h"
+#include "string.h"
 #include "utils.h"
+
+#ifdef LOCKSTAT
+#define NLOCKSTAT 64
+static struct lockstat lockstats[NLOCKSTAT];
+static int nlockstat;
+static uint64 lockstat_lock;  // a bare flag: a spinlock would count itself
+
+// find or make the stats entry for name; 0 if the table is full.
+static struct lockstat* lockstat_get(char* name)
+{
+    struct lockstat* ls = 0;
+    int i;
+    if (name == 0) {
+        return 0;
+    }
+    push_off();
+    while (__sync_lock_test_and_set(&lockstat_lock, 1) != 0) {
+        ;
+    }
+    for (i = 0; i < nlockstat; i++) {
+        if (strncmp(lockstats[i].name, name, sizeof(lockstats[i].name)) == 0) {
+            ls = &lockstats[i];
+            break;
+        }
+    }
+    if (ls == 0 && nlockstat < NLOCKSTAT) {
+        ls = &lockstats[nlockstat];
+        safestrcpy(ls->name, name, sizeof(ls->name));
+        __sync_synchronize();
+        nlockstat++;
+    }
+    __sync_lock_release(&lockstat_lock);
+    pop_off();
+    return ls;
+}
+
+// copy out up to n entries, most contended first; returns how many.
+int lockstat_top(struct lockstat* out, int n)
+{
+    int taken[NLOCKSTAT];
+    int i, k, best, cnt = nlockstat;
+
+    memset(taken, 0, sizeof(taken));
+    for (k = 0; k < n && k < cnt; k++) {
+        best = -1;
+        for (i = 0; i < cnt; i++) {
+            if (!taken[i] && (best < 0 || lockstats[i].contended > lockstats[best].contended)) {
+                best = i;
+            }
+        }
+        taken[best] = 1;
+        out[k] = lockstats[best];
+    }
+    return k;
+}
+#endif
+
 void initlock(struct spinlock* lk, char* name)
 {
-    lk->locked = 0;
+    lk->next = 0;
+    lk->owner = 0;
     lk->name = name;
     lk->cpu = 0;
+#ifdef LOCKSTAT
+    lk->stat = lockstat_get(name);
+#endif
 }
 
 void acquire(struct spinlock* lk)
 {
+    uint32 ticket;
     push_off();
-    while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+    if (holding(lk)) {
+        panic("acquire");
+    }
+    ticket = __sync_fetch_and_add(&lk->next, 1);
+#ifdef LOCKSTAT
+    if (lk->owner != ticket) {
+        uint64 t0 = r_time();
+        while (lk->owner != ticket) {
+            ;
+        }
+        if (lk->stat) {
+            __sync_fetch_and_add(&lk->stat->contended, 1);
+            __sync_fetch_and_add(&lk->stat->spin, r_time() - t0);
+        }
+    }
+    if (lk->stat) {
+        __sync_fetch_and_add(&lk->stat->acquires, 1);
+    }
+#else
+    while (lk->owner != ticket) {
         ;
     }
+#endif
     __sync_synchronize();
     lk->cpu = (uint64)mycpu();
+#ifdef LOCKSTAT
+    lk->held_since = r_time();
+#endif
 }
 
 void release(struct spinlock* lk)
@@ -25,16 +112,27 @@ void release(struct spinlock* lk)
     if (!holding(lk)) {
         panic("release");
     }
+#ifdef LOCKSTAT
+    if (lk->stat) {
+        uint64 hold = r_time() - lk->held_since;
+        uint64 old;
+        while ((old = lk->stat->maxhold) < hold &&
+               !__sync_bool_compare_and_swap(&lk->stat->maxhold, old, hold)) {
+            ;
+        }
+    }
+#endif
     lk->cpu = 0;
     __sync_synchronize();
-    __sync_lock_release(&lk->locked);
+    // only the holder writes owner, so a plain store is enough.
+    lk->owner = lk->owner + 1;
     pop_off();
 }
 
 int holding(struct spinlock* lk)
 {
     int r;
-    r = (lk->locked && lk->cpu == (uint64)mycpu());
+    r = (lk->next != lk->owner && lk->cpu == (uint64)mycpu());
     return r;
 }
 
@@ -1,10 +1,18 @@
 #ifndef _SPINLOCK_H_
 #define _SPINLOCK_H_
 #include "types.h"
+// ticket lock: acquire() takes a ticket from next and
+// spins until owner reaches it, so waiters get the lock
+// in arrival order. the lock is held while next != owner.
 struct spinlock {
-    uint64 locked;
+    volatile uint32 next;   // next ticket to hand out
+    volatile uint32 owner;  // ticket now allowed to hold the lock
     char* name;
     uint64 cpu;
+#ifdef LOCKSTAT
+    struct lockstat* stat;  // shared by all locks with this name
+    uint64 held_since;      // r_time() at acquire
+#endif
 };
 void initlock(struct spinlock* lk, char* name);
 void acquire(struct spinlock* lk);
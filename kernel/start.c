@@ -1,12 +1,93 @@
 #include "riscv.h"
 #include "memlayout.h"
 #include "param.h"
+#include "string.h"
 
 char stack[4 * 1024];
-uint64 timer_scratch[N_CPU][5];
+uint64 timer_scratch[N_CPU][7];
+
+// timer configuration, read from the device tree at boot.
+uint64 timebase = 10000000; // time csr ticks per second
+uint64 tickhz = TICKHZ;     // scheduler ticks per second
+uint64 tick_interval;       // time csr ticks per scheduler tick
+uint64 boottime;            // time csr when hart 0 booted
+int sstc;                   // supervisor mode can write stimecmp
+
+int iosched = IOSCHED;      // disk scheduling policy, see iosched.c
+
 void timervec();
 void main();
-void start()
+void* fdt_getprop(uint64 dtb, char *path, char *prop, int *len);
+uint32 be32(void *p);
+
+// value of "key=N" on the kernel command line (qemu -append),
+// or def if it is absent.
+static uint64 bootarg(char* args, int len, char* key, uint64 def)
+{
+    int klen = strlen(key);
+    uint64 v;
+    for (int i = 0; i + klen < len; i++) {
+        if ((i > 0 && args[i - 1] != ' ') || strncmp(args + i, key, klen) != 0 || args[i + klen] != '=') {
+            continue;
+        }
+        v = 0;
+        for (i += klen + 1; i < len && args[i] >= '0' && args[i] <= '9'; i++) {
+            v = v * 10 + args[i] - '0';
+        }
+        return v;
+    }
+    return def;
+}
+
+// is ext one of the '_' or '\0' separated words in list?
+// works for both "riscv,isa" and "riscv,isa-extensions".
+static int hasext(char* list, int len, char* ext)
+{
+    int n = strlen(ext);
+    for (int i = 0; i < len; i++) {
+        if ((i == 0 || list[i - 1] == '_' || list[i - 1] == 0) &&
+            i + n <= len && strncmp(list + i, ext, n) == 0 &&
+            (i + n == len || list[i + n] == '_' || list[i + n] == 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void timerconfig(uint64 dtb)
+{
+    void* v;
+    int len;
+
+    if ((v = fdt_getprop(dtb, "/cpus", "timebase-frequency", &len)) != 0 && len == 4) {
+        timebase = be32(v);
+    }
+    if ((v = fdt_getprop(dtb, "/chosen", "bootargs", &len)) != 0) {
+        tickhz = bootarg(v, len, "tickhz", TICKHZ);
+    }
+    if (tickhz == 0 || tickhz > timebase) {
+        tickhz = TICKHZ;
+    }
+    tick_interval = timebase / tickhz;
+    if (((v = fdt_getprop(dtb, "/cpus/cpu", "riscv,isa-extensions", &len)) != 0 && hasext(v, len, "sstc")) ||
+        ((v = fdt_getprop(dtb, "/cpus/cpu", "riscv,isa", &len)) != 0 && hasext(v, len, "sstc"))) {
+        sstc = 1;
+    }
+}
+
+// the rest of the kernel command line.
+static void bootconfig(uint64 dtb)
+{
+    void* v;
+    int len;
+
+    if ((v = fdt_getprop(dtb, "/chosen", "bootargs", &len)) != 0) {
+        iosched = bootarg(v, len, "iosched", IOSCHED);
+    }
+}
+
+// qemu passes the hartid in a0 and the device tree in a1.
+void start(uint64 a0, uint64 dtb)
 {
     // supervisor mode init
 
@@ -24,18 +105,37 @@ void start()
     w_pmpcfg0(0xf);
     // timer init
     int id = r_mhartid();
-    int interval = 10000000;
-    *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+    timerconfig(dtb);
+    bootconfig(dtb);
+    if (id == 0) {
+        boottime = *(uint64*)CLINT_MTIME;
+    }
+
+    // let supervisor mode read the time csr.
+    w_mcounteren(r_mcounteren() | 2);
+
+    // the timer is one-shot: trap.c reprograms it for the next
+    // deadline on every interrupt. with Sstc, supervisor mode
+    // owns stimecmp and timer interrupts skip timervec entirely.
+    if (sstc) {
+        w_menvcfg(r_menvcfg() | MENVCFG_STCE);
+        w_stimecmp(*(uint64*)CLINT_MTIME + tick_interval);
+    } else {
+        *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + tick_interval;
+        w_mie(r_mie() | MIE_MTIE);
+    }
     uint64 *scratch = &timer_scratch[id][0];
     scratch[3] = CLINT_MTIMECMP(id);
-    scratch[4] = interval;
+    scratch[4] = 0;
+    scratch[5] = 0;
+    scratch[6] = CLINT_MSIP(id);
     w_mscratch((uint64)scratch);
     w_mtvec((uint64)timervec);
-    w_mie(r_mie()| MIE_MTIE);
+    w_mie(r_mie() | MIE_MSIE);
     w_mstatus(r_mstatus()| MSTATUS_MIE);
 
     // keep each CPU's hartid in its tp register, for cpuid().
     w_tp(id);
     // switch to supervisor mode and jump to main().
     asm volatile("mret");
-}
\ No newline at end of file
+}
@@ -10,12 +10,23 @@
 #include "fcntl.h"
 #include "stat.h"
 #include "defs.h"
+#include "cpustat.h"
+#include "time.h"
+#include "lockstat.h"
+#include "ring.h"
+#include "memlayout.h"
+#include "bcachestat.h"
+#include "iostat.h"
 
 extern uint ticks;
+extern uint64 tick_interval;
+extern uint64 boottime;
+extern struct cpu cpus[N_CPU];
+extern struct spinlock wait_lock;
 int fetchaddr(uint64 addr, uint64* ip)
 {
     struct proc* p = myproc();
-    if (addr >= p->sz || addr + sizeof(uint64) >= p->sz) {
+    if (addr >= p->leader->sz || addr + sizeof(uint64) >= p->leader->sz) {
         return -1;
     }
     if (copyin(p->pagetable, (char*)ip, addr, sizeof(*ip)) != 0) {
@@ -81,7 +92,7 @@ uint64 sys_exit(void)
 uint64 sys_sbrk(void)
 {
     int n = 0;
-    int oldsz = myproc()->sz;
+    int oldsz = myproc()->leader->sz;
     argint(0, &n);
     if (growproc(n)) {
         return -1;
@@ -89,21 +100,173 @@ uint64 sys_sbrk(void)
     return oldsz;
 }
 
+// sleep until time `when`; -1 if killed first.
+static int sleeptill(uint64 when)
+{
+    struct proc* p = myproc();
+    while (r_time() < when) {
+        if (killed(p)) {
+            return -1;
+        }
+        sleep_until(&p->when, 0, when);
+    }
+    return 0;
+}
+
 uint64 sys_sleep()
 {
     int n;
-    uint ticks0;
     argint(0, &n);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n) {
-        if (killed(myproc())) {
+    if (n < 0) {
+        n = 0;
+    }
+    return sleeptill(r_time() + (uint64)n * tick_interval);
+}
+
+uint64 sys_nanosleep()
+{
+    uint64 req, rem, now, when;
+    struct timespec ts;
+    struct proc* p = myproc();
+
+    argaddr(0, &req);
+    argaddr(1, &rem);
+    if (copyin(p->pagetable, (char*)&ts, req, sizeof(ts)) < 0 || ts.tv_nsec >= 1000000000) {
+        return -1;
+    }
+    when = r_time() + ts2time(&ts);
+    if (sleeptill(when) == 0) {
+        return 0;
+    }
+    // interrupted: report how much was left.
+    if (rem) {
+        now = r_time();
+        time2ts(when > now ? when - now : 0, &ts);
+        copyout(p->pagetable, rem, (char*)&ts, sizeof(ts));
+    }
+    return -1;
+}
+
+uint64 sys_clock_gettime()
+{
+    int clk;
+    uint64 addr;
+    struct timespec ts;
+
+    argint(0, &clk);
+    argaddr(1, &addr);
+    if (clk != CLOCK_MONOTONIC) {
+        return -1;
+    }
+    time2ts(r_time() - boottime, &ts);
+    if (copyout(myproc()->pagetable, addr, (char*)&ts, sizeof(ts)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+uint64 sys_clone()
+{
+    uint64 fcn, arg1, arg2, stack;
+
+    argaddr(0, &fcn);
+    argaddr(1, &arg1);
+    argaddr(2, &arg2);
+    argaddr(3, &stack);
+    return clone(fcn, arg1, arg2, stack);
+}
+
+uint64 sys_join()
+{
+    uint64 addr;
+
+    argaddr(0, &addr);
+    return join(addr);
+}
+
+uint64 sys_futex_wait()
+{
+    uint64 addr, tsp, when = 0;
+    int val;
+    struct timespec ts;
+
+    argaddr(0, &addr);
+    argint(1, &val);
+    argaddr(2, &tsp);
+    if (tsp) {
+        if (copyin(myproc()->pagetable, (char*)&ts, tsp, sizeof(ts)) < 0 || ts.tv_nsec >= 1000000000) {
             return -1;
         }
-        sleep(&ticks, 0);
+        when = r_time() + ts2time(&ts);
+    }
+    return futex_wait(addr, val, when);
+}
+
+uint64 sys_futex_wake()
+{
+    uint64 addr;
+    int n;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    return futex_wake(addr, n);
+}
+
+uint64 sys_sched_setaffinity()
+{
+    int pid;
+    uint64 mask;
+
+    argint(0, &pid);
+    argaddr(1, &mask);
+    return setaffinity(pid, mask);
+}
+
+uint64 sys_sched_getaffinity()
+{
+    int pid;
+    uint64 addr, mask;
+
+    argint(0, &pid);
+    argaddr(1, &addr);
+    if (getaffinity(pid, &mask) < 0) {
+        return -1;
+    }
+    if (copyout(myproc()->pagetable, addr, (char*)&mask, sizeof(mask)) < 0) {
+        return -1;
     }
     return 0;
 }
 
+// copy the n most contended lock names' statistics to addr;
+// returns how many, or -1 if the kernel was built without LOCKSTAT.
+uint64 sys_lockstat()
+{
+#ifdef LOCKSTAT
+    uint64 addr;
+    int n, i;
+    struct lockstat ls[16];
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    if (n < 0) {
+        return -1;
+    }
+    if (n > NELEM(ls)) {
+        n = NELEM(ls);
+    }
+    n = lockstat_top(ls, n);
+    for (i = 0; i < n; i++) {
+        if (copyout(myproc()->pagetable, addr + i * sizeof(ls[0]), (char*)&ls[i], sizeof(ls[0])) < 0) {
+            return -1;
+        }
+    }
+    return n;
+#else
+    return -1;
+#endif
+}
+
 uint64 sys_fork(void)
 {
   return fork();
@@ -160,7 +323,7 @@ static int argfd(int n, int *pfd, struct file **pf)
     struct file *f;
 
     argint(n, &fd);
-    if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+    if(fd < 0 || fd >= NOFILE || (f=myproc()->leader->ofile[fd]) == 0)
         return -1;
     if(pfd)
         *pfd = fd;
@@ -174,7 +337,7 @@ static int argfd(int n, int *pfd, struct file **pf)
 static int fdalloc(struct file *f)
 {
     int fd;
-    struct proc *p = myproc();
+    struct proc *p = myproc()->leader;
 
     for(fd = 0; fd < NOFILE; fd++){
         if(p->ofile[fd] == 0){
@@ -232,7 +395,7 @@ uint64 sys_close(void)
 
     if(argfd(0, &fd, &f) < 0)
         return -1;
-    myproc()->ofile[fd] = 0;
+    myproc()->leader->ofile[fd] = 0;
     fileclose(f);
     return 0;
 }
@@ -248,6 +411,25 @@ uint64 sys_fstat(void)
     return filestat(f, st);
 }
 
+// the log keeps one transaction for the whole disk, so making
+// one file's writes durable commits everyone's.
+uint64 sys_fsync(void)
+{
+    struct file *f;
+
+    if(argfd(0, 0, &f) < 0)
+        return -1;
+    if(f->type == FD_INODE)
+        log_sync();
+    return 0;
+}
+
+uint64 sys_sync(void)
+{
+    log_sync();
+    return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64 sys_link(void)
 {
@@ -257,13 +439,16 @@ uint64 sys_link(void)
     if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
         return -1;
 
+    begin_op();
     if((ip = namei(old)) == 0){
+        end_op();
         return -1;
     }
 
     ilock(ip);
     if(ip->type == T_DIR){
         iunlockput(ip);
+        end_op();
         return -1;
     }
 
@@ -281,6 +466,8 @@ uint64 sys_link(void)
     iunlockput(dp);
     iput(ip);
 
+    end_op();
+
     return 0;
 
     bad:
@@ -288,6 +475,7 @@ uint64 sys_link(void)
     ip->nlink--;
     iupdate(ip);
     iunlockput(ip);
+    end_op();
     return -1;
 }
 
@@ -316,7 +504,9 @@ uint64 sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
+  begin_op();
   if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
   }
 
@@ -350,10 +540,13 @@ uint64 sys_unlink(void)
   iupdate(ip);
   iunlockput(ip);
 
+  end_op();
+
   return 0;
 
 bad:
   iunlockput(dp);
+  end_op();
   return -1;
 }
 
@@ -428,24 +621,30 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
+  begin_op();
+
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
+      end_op();
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
+      end_op();
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
+    end_op();
     return -1;
   }
 
@@ -453,6 +652,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
+    end_op();
     return -1;
   }
 
@@ -462,6 +662,7 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ra.next = f->ra.end = f->ra.win = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -472,6 +673,7 @@ sys_open(void)
   }
 
   iunlock(ip);
+  end_op();
 
   return fd;
 }
@@ -482,10 +684,13 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
+  begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
   }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -496,13 +701,16 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
+  begin_op();
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
      (ip = create(path, T_DEVICE, major, minor)) == 0){
+    end_op();
     return -1;
   }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -511,18 +719,22 @@ sys_chdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
   
+  begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
   }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
   iput(p->cwd);
+  end_op();
   p->cwd = ip;
   return 0;
 }
@@ -547,15 +759,15 @@ uint64 sys_pipe()
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      p->leader->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    p->leader->ofile[fd0] = 0;
+    p->leader->ofile[fd1] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -570,14 +782,95 @@ uint64 sys_kill()
 
 uint64 sys_getpid()
 {
-  return -1;
+  return myproc()->pid;
 }
 
+// scheduler ticks since boot.
 uint64 sys_uptime()
 {
-  return -1;
+  return (r_time() - boottime) / tick_interval;
 }
 
+uint64 sys_cpustat()
+{
+  int hart;
+  uint64 addr;
+  struct cpu *c;
+  struct cpustat st;
+
+  argint(0, &hart);
+  argaddr(1, &addr);
+  if(hart < 0 || hart >= N_CPU)
+    return -1;
+  c = &cpus[hart];
+  st.uptime = c->start ? r_time() - c->start : 0;
+  st.idle = c->idle_time;
+  st.wakeups = c->wakeups;
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64 sys_getrusage()
+{
+  int who;
+  uint64 addr;
+  struct proc *p = myproc();
+  struct rusage ru;
+
+  argint(0, &who);
+  argaddr(1, &addr);
+  // wait_lock keeps cru still while it is copied.
+  acquire(&wait_lock);
+  if(who == RUSAGE_SELF)
+    ru = p->ru;
+  else if(who == RUSAGE_CHILDREN)
+    ru = p->cru;
+  else {
+    release(&wait_lock);
+    return -1;
+  }
+  release(&wait_lock);
+  if(copyout(p->pagetable, addr, (char*)&ru, sizeof(ru)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64 sys_bcachestat()
+{
+  uint64 addr;
+  struct bcachestat st;
+
+  argaddr(0, &addr);
+  bcachestat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64 sys_bcachelimit()
+{
+  int n;
+
+  argint(0, &n);
+  return bcachelimit(n);
+}
+
+uint64 sys_iostat()
+{
+  uint64 addr;
+  struct iostat st;
+
+  argaddr(0, &addr);
+  iostat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64 sys_ring_setup();
+uint64 sys_ring_enter();
+
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
 static uint64 (*syscalls[])(void) = {
@@ -602,6 +895,24 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_cpustat] sys_cpustat,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_lockstat] sys_lockstat,
+[SYS_getrusage] sys_getrusage,
+[SYS_ring_setup] sys_ring_setup,
+[SYS_ring_enter] sys_ring_enter,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_iostat]  sys_iostat,
+[SYS_bcachelimit] sys_bcachelimit,
 };
 
 void syscall()
@@ -612,5 +923,84 @@ void syscall()
         myproc()->trapframe->a0 = -1;
         return;
     }
+    myproc()->ru.syscalls[a7]++;
     myproc()->trapframe->a0 = syscalls[a7]();
-}
\ No newline at end of file
+}
+
+// map the caller's syscall rings at RING, once; returns RING.
+uint64 sys_ring_setup()
+{
+    struct proc* p = myproc()->leader;
+    struct ring* r;
+
+    if (p->ring) {
+        return RING;
+    }
+    if ((r = kalloc()) == 0) {
+        return -1;
+    }
+    memset(r, 0, PGSIZE);
+    if (mappages(p->pagetable, RING, PGSIZE, (uint64)r, PTE_R | PTE_W | PTE_U) != 0) {
+        kfree(r);
+        return -1;
+    }
+    p->ring = r;
+    return RING;
+}
+
+// run up to n submitted entries, posting a completion for each,
+// as if each had been its own ecall. stops early when the
+// completion ring is full. returns the number consumed.
+// threads share the ring, and an entry's syscall may sleep, so
+// the whole call holds the leader's ringlock: otherwise two
+// threads could run the same entry and fill the same completion.
+uint64 sys_ring_enter()
+{
+    struct proc* p = myproc();
+    struct trapframe* tf = p->trapframe;
+    struct trapframe saved = *tf;
+    struct ring* r = p->leader->ring;
+    struct sqe e;
+    uint32 head, tail;
+    long res;
+    int n, done;
+
+    argint(0, &n);
+    if (r == 0 || n < 0) {
+        return -1;
+    }
+    acquiresleep(&p->leader->ringlock);
+    for (done = 0; done < n; done++) {
+        head = r->sq_head;
+        tail = r->sq_tail;
+        if (head == tail || r->cq_tail - r->cq_head >= RING_ENTRIES) {
+            break;
+        }
+        __sync_synchronize();
+        // copy it first: another thread may be writing the ring.
+        e = r->sq[head % RING_ENTRIES];
+        if (e.op < 0 || e.op >= 32 || !(RING_OPS & (1 << e.op))) {
+            res = -1;
+        } else {
+            tf->a0 = e.args[0];
+            tf->a1 = e.args[1];
+            tf->a2 = e.args[2];
+            tf->a3 = e.args[3];
+            tf->a7 = e.op;
+            p->ru.syscalls[e.op]++;
+            res = syscalls[e.op]();
+        }
+        r->cq[r->cq_tail % RING_ENTRIES].user_data = e.user_data;
+        r->cq[r->cq_tail % RING_ENTRIES].res = res;
+        __sync_synchronize();
+        r->cq_tail++;
+        r->sq_head = head + 1;
+        if (killed(p)) {
+            done++;
+            break;
+        }
+    }
+    releasesleep(&p->leader->ringlock);
+    *tf = saved;
+    return done;
+}
@@ -2,6 +2,7 @@
 #define _SYSCALL_H_
 
 // System call numbers
+#define NSYSCALL    48  // bound on SYS_ numbers, for struct rusage
 #define SYS_test    0
 #define SYS_fork    1
 #define SYS_exit    2
@@ -24,5 +25,23 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_cpustat 22
+#define SYS_nanosleep 23
+#define SYS_clock_gettime 24
+#define SYS_clone 25
+#define SYS_join 26
+#define SYS_futex_wait 27
+#define SYS_futex_wake 28
+#define SYS_sched_setaffinity 29
+#define SYS_sched_getaffinity 30
+#define SYS_lockstat 31
+#define SYS_getrusage 32
+#define SYS_ring_setup 33
+#define SYS_ring_enter 34
+#define SYS_fsync 35
+#define SYS_sync 36
+#define SYS_bcachestat 37
+#define SYS_iostat 38
+#define SYS_bcachelimit 39
 
 #endif
\ No newline at end of file
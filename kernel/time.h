@@ -0,0 +1,11 @@
+#ifndef _TIME_H_
+#define _TIME_H_
+#include "types.h"
+#define CLOCK_MONOTONIC 1 // time since boot; there is no realtime clock
+
+struct timespec {
+  uint64 tv_sec;
+  uint64 tv_nsec;
+};
+
+#endif
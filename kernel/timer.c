@@ -0,0 +1,223 @@
+//
+// timers.
+// instead of a fixed periodic tick, each hart arms its timer
+// for the nearest deadline it cares about: the end of the
+// running process's time slice, or the earliest process timer.
+// a hart idling with nothing to wake for takes no timer
+// interrupts at all.
+//
+// a process has at most one timer, armed by sleep_until().
+// armed timers live in a min-heap ordered by deadline, so an
+// expiry wakes exactly the process that asked for it instead
+// of every sleeper re-checking the time on every tick.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "time.h"
+#include "defs.h"
+
+extern uint64 timebase;
+extern uint64 tick_interval;
+extern uint64 boottime;
+extern int sstc;
+
+struct {
+    struct spinlock lock;
+    struct proc* heap[N_PROC + 1]; // 1-based; heap[1] expires first
+    int n;
+    // heap[1]->when, or -1 when empty. readable without the lock,
+    // since timer_rearm() runs with p->lock held and expiry takes
+    // timers.lock before p->lock.
+    volatile uint64 next;
+} timers;
+
+void timerinit()
+{
+    initlock(&timers.lock, "timers");
+    timers.next = -1;
+}
+
+static void heapset(int i, struct proc* p)
+{
+    timers.heap[i] = p;
+    p->tidx = i;
+}
+
+static void heapup(int i)
+{
+    struct proc* p = timers.heap[i];
+    while (i > 1 && timers.heap[i / 2]->when > p->when) {
+        heapset(i, timers.heap[i / 2]);
+        i /= 2;
+    }
+    heapset(i, p);
+}
+
+static void heapdown(int i)
+{
+    struct proc* p = timers.heap[i];
+    int c;
+    while ((c = 2 * i) <= timers.n) {
+        if (c < timers.n && timers.heap[c + 1]->when < timers.heap[c]->when) {
+            c++;
+        }
+        if (timers.heap[c]->when >= p->when) {
+            break;
+        }
+        heapset(i, timers.heap[c]);
+        i = c;
+    }
+    heapset(i, p);
+}
+
+// caller must hold timers.lock.
+static void heapdel(struct proc* p)
+{
+    int i = p->tidx;
+    struct proc* last = timers.heap[timers.n--];
+    p->tidx = 0;
+    if (last != p) {
+        timers.heap[i] = last;
+        last->tidx = i;
+        heapup(i);
+        heapdown(last->tidx);
+    }
+    timers.next = timers.n ? timers.heap[1]->when : -1;
+}
+
+// arm p's timer for time `when`.
+static void timer_add(struct proc* p, uint64 when)
+{
+    acquire(&timers.lock);
+    if (p->tidx) {
+        heapdel(p);
+    }
+    p->timedout = 0;
+    if (when <= r_time()) {
+        p->timedout = 1;
+    } else {
+        p->when = when;
+        timers.n++;
+        heapset(timers.n, p);
+        heapup(timers.n);
+        timers.next = timers.heap[1]->when;
+    }
+    release(&timers.lock);
+}
+
+// disarm p's timer. returns 1 if it had already expired.
+static int timer_del(struct proc* p)
+{
+    int expired;
+    acquire(&timers.lock);
+    if (p->tidx) {
+        heapdel(p);
+    }
+    expired = p->timedout;
+    p->timedout = 0;
+    release(&timers.lock);
+    return expired;
+}
+
+// wake every process whose deadline has passed.
+// called from clockintr().
+void timer_expire(uint64 now)
+{
+    struct proc* p;
+    uint64 woken = 0;
+
+    acquire(&timers.lock);
+    while (timers.n > 0 && timers.heap[1]->when <= now) {
+        p = timers.heap[1];
+        heapdel(p);
+        acquire(&p->lock);
+        p->timedout = 1;
+        if (p->status == SLEEPING) {
+            p->status = RUNNABLE;
+            woken |= p->cpumask;
+        }
+        release(&p->lock);
+    }
+    release(&timers.lock);
+    if (woken) {
+        kickidle(woken);
+    }
+}
+
+// sleep on chan, releasing lk, like sleep(), but also wake
+// up at time `when`. returns 1 if the deadline passed.
+// sleep() refuses to block once the timer has expired, so an
+// expiry between timer_add() and sched() is not lost.
+int sleep_until(void* chan, struct spinlock* lk, uint64 when)
+{
+    struct proc* p = myproc();
+    timer_add(p, when);
+    sleep(chan, lk);
+    return timer_del(p);
+}
+
+// program this hart's next timer interrupt for time `when`.
+static void settimer(uint64 when)
+{
+    if (sstc) {
+        w_stimecmp(when);
+    } else {
+        *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+    }
+}
+
+// arm the timer for this hart's nearest deadline.
+// called with interrupts off whenever the hart picks
+// something to run, goes idle, or takes a timer interrupt.
+void timer_rearm()
+{
+    struct cpu* c = mycpu();
+    uint64 now = r_time();
+    uint64 next = -1;
+
+    if (c->proc) {
+        // a tick taken in the kernel does not yield, so an
+        // expired slice is simply renewed.
+        if (c->slice_end <= now) {
+            c->slice_end = now + tick_interval;
+        }
+        next = c->slice_end;
+    }
+    if (timers.next < next) {
+        next = timers.next;
+    }
+    settimer(next);
+}
+
+// start a new time slice for the process this hart is about to run.
+void timer_slice()
+{
+    mycpu()->slice_end = r_time() + tick_interval;
+    timer_rearm();
+}
+
+// longest timeout ts2time() returns, in ticks: thousands of years,
+// and small enough that r_time() + ts2time() cannot wrap.
+#define MAXTICKS (~0UL >> 2)
+
+// convert between time csr ticks since boot and a timespec.
+// callers reject tv_nsec >= 1e9; a huge (or negative, cast to
+// unsigned) tv_sec saturates at MAXTICKS instead of wrapping.
+uint64 ts2time(struct timespec* ts)
+{
+    if (ts->tv_sec >= MAXTICKS / timebase) {
+        return MAXTICKS;
+    }
+    return ts->tv_sec * timebase + ts->tv_nsec * timebase / 1000000000;
+}
+
+void time2ts(uint64 t, struct timespec* ts)
+{
+    ts->tv_sec = t / timebase;
+    ts->tv_nsec = (t % timebase) * 1000000000 / timebase;
+}
@@ -2,10 +2,11 @@
 #include "proc.h"
 #include "utils.h"
 #include "memlayout.h"
+#include "param.h"
 void usertrapret();
 extern char _trampoline[];
 extern char trampoline[];
-void userret(uint64 satp);
+void userret(uint64 satp, uint64 trapva);
 void uservec();
 void usertrapret();
 void syscall();
@@ -35,10 +36,33 @@ char EXCEPTION_CAUSE[][100] = {
 [14] "Reserved\n",
 [15] "Store/AMO page fault\n"
 };
+// written by timervec in kernelvec.S; see start.c.
+extern uint64 timer_scratch[N_CPU][7];
+
+// did timervec raise the current software interrupt
+// for a tick (as opposed to another hart's ipi)?
+static int tickpending()
+{
+    return __sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0);
+}
+
+extern uint64 tick_interval;
+extern uint64 boottime;
+void timer_rearm();
+void timer_expire(uint64 now);
+int fpu_trap(struct proc* p);
+
+// a timer deadline passed. ticks is derived from the clock
+// rather than counted, since interrupts are no longer periodic.
 void clockintr()
 {
-    ticks++;
-    wakeup(&ticks);
+    uint64 now = r_time();
+    uint t = (now - boottime) / tick_interval;
+    if (t > ticks) {
+        ticks = t;
+    }
+    timer_expire(now);
+    timer_rearm();
 }
 
 int devintr()
@@ -65,10 +89,19 @@ int devintr()
         return 1;
     }
     if (scause == 0x8000000000000001L) {
-        if (cpuid() == 0) {
-            clockintr();
-        }
+        // software interrupt from timervec. acknowledge it
+        // before looking at the cause, so a tick that lands
+        // in between raises a fresh interrupt.
         w_sip(r_sip() & ~2);
+        if (!tickpending()) {
+            // an ipi: its only job was to get us out of wfi.
+            return 3;
+        }
+        clockintr();
+        return 2;
+    } else if (scause == 0x8000000000000005L) {
+        // supervisor timer interrupt straight from stimecmp (Sstc).
+        clockintr();
         return 2;
     } else {
         printf("%s", EXCEPTION_CAUSE[scause]);
@@ -89,6 +122,10 @@ void usertrap()
     struct proc *p = myproc();
     p->trapframe->epc = r_sepc();
 
+    uint64 now = r_time();
+    p->ru.utime += now - p->tstamp;
+    p->tstamp = now;
+
     uint64 scause = r_scause();
     if (scause == 8) {
         if (killed(p)) {
@@ -97,9 +134,14 @@ void usertrap()
         p->trapframe->epc += 4;
         intr_on();
         syscall();
+    } else if (scause == 2 && fpu_trap(p)) {
+        // first fp instruction since a switch; retry it.
     } else if ((which_dev = devintr()) != 0) {
         // ok
     } else {
+        if (scause == 12 || scause == 13 || scause == 15) {
+            p->ru.faults++;
+        }
         printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
         printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
         setkilled(p);
@@ -132,11 +174,16 @@ void usertrapret()
     p->trapframe->kernel_hartid = r_tp();
 
     w_sepc(p->trapframe->epc);
+    vdsoupdate(p);
+
+    uint64 now = r_time();
+    p->ru.stime += now - p->tstamp;
+    p->tstamp = now;
 
     uint64 satp = MAKE_SATP(p->pagetable);
 
     uint64 trampoline_userret = TRAMPOLINE + ((char*)userret - trampoline);
-    ((void (*)(uint64))trampoline_userret)(satp);
+    ((void (*)(uint64, uint64))trampoline_userret)(satp, p->trapva);
 }
 
 void kerneltrap()
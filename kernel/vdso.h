@@ -0,0 +1,16 @@
+#ifndef _VDSO_H_
+#define _VDSO_H_
+#include "types.h"
+// the read-only page the kernel maps at VDSO in every process,
+// so user code can read the clock without a system call.
+// time since boot in seconds is (rdtime - boottime) / timebase.
+struct vdso {
+  volatile uint32 seq;  // seqlock: odd while the kernel updates ticks
+  int pid;
+  volatile uint64 ticks; // scheduler ticks since boot, as of the last trap
+  uint64 timebase;       // time csr ticks per second
+  uint64 boottime;       // time csr at boot
+  uint64 tick_interval;  // time csr ticks per scheduler tick
+};
+
+#endif
@@ -29,6 +29,7 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration space
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -37,6 +38,7 @@
 #define VIRTIO_CONFIG_S_FEATURES_OK	8
 
 // device feature bits
+#define VIRTIO_BLK_F_SEG_MAX         2	/* Maximum number of segments in a request is in seg_max */
 #define VIRTIO_BLK_F_RO              5	/* Disk is read-only */
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
@@ -45,9 +47,13 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
+// this many virtio descriptors: a request takes one for its
+// header, one per block, and one for its status.
 // must be a power of two.
-#define NUM 8
+#define NUM 64
+
+// most blocks in one request, if the device allows.
+#define MAXSEG 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -58,13 +64,14 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with event idx: interrupt when used idx passes this
 };
 
 // one entry in the "used" ring, with which the
@@ -78,6 +85,7 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with event idx: notify when avail idx passes this
 };
 
 // these are specific to virtio block devices, e.g. disks,
@@ -87,10 +95,32 @@ struct virtq_used {
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by descriptors for the blocks, and
+// one for a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
   uint64 sector;
 };
+
+// the start of the block device's configuration space.
+struct virtio_blk_config {
+  uint64 capacity; // in 512-byte sectors
+  uint32 size_max; // largest segment, if VIRTIO_BLK_F_SIZE_MAX
+  uint32 seg_max;  // most segments in a request, if VIRTIO_BLK_F_SEG_MAX
+  struct {
+    uint16 cylinders;
+    uint8 heads;
+    uint8 sectors;
+  } geometry;
+  uint32 blk_size;
+  struct {
+    uint8 physical_block_exp;
+    uint8 alignment_offset;
+    uint16 min_io_size;
+    uint32 opt_io_size;
+  } topology;
+  uint8 writeback;
+  uint8 unused0;
+  uint16 num_queues; // if VIRTIO_BLK_F_MQ
+};
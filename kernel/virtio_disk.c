@@ -4,6 +4,17 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// requests come from the I/O scheduler (iosched.c), which also
+// completes them. if the device offers them, the driver uses:
+//  - one queue per hart (VIRTIO_BLK_F_MQ), each with its own
+//    lock, so harts submit without contending;
+//  - indirect descriptors (VIRTIO_RING_F_INDIRECT_DESC), so a
+//    request takes one ring slot however many blocks it has;
+//  - event indices (VIRTIO_RING_F_EVENT_IDX), so the driver
+//    notifies only when the device has asked to hear of new
+//    requests, and the device interrupts only for completions
+//    the driver hasn't already seen.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -18,11 +29,22 @@
 #include "kmem.h"
 #include "string.h"
 #include "proc.h"
+#include "iostat.h"
+
+void iosched_init(int nq, int maxseg);
+void iosched_add(int qi, struct buf *b, int n, int write, int async);
+struct buf* iosched_next(int qi, int room);
+void iosched_done(struct buf *b);
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
+// at most one queue per hart.
+#define NVQ N_CPU
+
+struct vq {
+  struct spinlock lock;
+
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -43,22 +65,34 @@ static struct disk {
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
+  int nfree;
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // the first buf, linked through qnext
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
+
+  // with indirect descriptors, the table each request's one
+  // ring descriptor points to. indexed like info[].
+  struct virtq_desc indirect[NUM][MAXSEG + 2];
+};
+
+static struct disk {
+  struct vq vq[NVQ];
+  int nvq;         // queues in use
+  int maxseg;      // most blocks we put in one request
+  int indirect;    // VIRTIO_RING_F_INDIRECT_DESC was negotiated
+  int eventidx;    // VIRTIO_RING_F_EVENT_IDX was negotiated
+  uint64 notifies;
+  uint64 intrs;
 } disk;
 
 void
@@ -66,15 +100,13 @@ virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
      *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
     panic("could not find virtio disk");
   }
-  
+
   // reset device
   *R(VIRTIO_MMIO_STATUS) = status;
 
@@ -88,13 +120,11 @@ virtio_disk_init(void)
 
   // negotiate features
   uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  // seg_max, mq, event idx and indirect descriptors are kept.
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -106,47 +136,79 @@ virtio_disk_init(void)
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
-
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
-
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  volatile struct virtio_blk_config *cfg = (struct virtio_blk_config *)R(VIRTIO_MMIO_CONFIG);
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk.eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  disk.nvq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    disk.nvq = cfg->num_queues;
+    if(disk.nvq > NVQ)
+      disk.nvq = NVQ;
+    if(disk.nvq < 1)
+      disk.nvq = 1;
+  }
+
+  for(int q = 0; q < disk.nvq; q++){
+    struct vq *vq = &disk.vq[q];
+
+    initlock(&vq->lock, "virtio_disk");
+
+    // initialize queue q.
+    *R(VIRTIO_MMIO_QUEUE_SEL) = q;
+
+    // ensure queue q is not in use.
+    if(*R(VIRTIO_MMIO_QUEUE_READY))
+      panic("virtio disk should not be ready");
+
+    // check maximum queue size.
+    uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if(max == 0)
+      panic("virtio disk has no queue");
+    if(max < NUM)
+      panic("virtio disk max queue too short");
+
+    // allocate and zero queue memory.
+    vq->desc = kalloc();
+    vq->avail = kalloc();
+    vq->used = kalloc();
+    if(!vq->desc || !vq->avail || !vq->used)
+      panic("virtio disk kalloc");
+    memset(vq->desc, 0, PGSIZE);
+    memset(vq->avail, 0, PGSIZE);
+    memset(vq->used, 0, PGSIZE);
+
+    // set queue size.
+    *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+
+    // write physical addresses.
+    *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)vq->desc;
+    *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)vq->desc >> 32;
+    *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)vq->avail;
+    *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)vq->avail >> 32;
+    *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)vq->used;
+    *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)vq->used >> 32;
+
+    // queue is ready.
+    *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+    // all NUM descriptors start out unused.
+    for(int i = 0; i < NUM; i++)
+      vq->free[i] = 1;
+    vq->nfree = NUM;
+  }
+
+  // a request may carry as many blocks as the device allows,
+  // as MAXSEG, and as fit in the ring.
+  disk.maxseg = MAXSEG;
+  if(features & (1 << VIRTIO_BLK_F_SEG_MAX)){
+    if(cfg->seg_max < disk.maxseg)
+      disk.maxseg = cfg->seg_max;
+  }
+  if(disk.maxseg > NUM - 2)
+    disk.maxseg = NUM - 2;
+  if(disk.maxseg < 1)
+    disk.maxseg = 1;
+  iosched_init(disk.nvq, disk.maxseg);
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -157,11 +219,12 @@ virtio_disk_init(void)
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *vq)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(vq->free[i]){
+      vq->free[i] = 0;
+      vq->nfree--;
       return i;
     }
   }
@@ -170,28 +233,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *vq, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(vq->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  vq->desc[i].addr = 0;
+  vq->desc[i].len = 0;
+  vq->desc[i].flags = 0;
+  vq->desc[i].next = 0;
+  vq->free[i] = 1;
+  vq->nfree++;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *vq, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = vq->desc[i].flags;
+    int nxt = vq->desc[i].next;
+    free_desc(vq, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -199,106 +262,209 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct vq *vq, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(vq);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(vq, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// most blocks a request could carry and still fit on vq now.
+static int
+room(struct vq *vq)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  if(disk.indirect)
+    return vq->nfree > 0 ? disk.maxseg : 0;
+  return vq->nfree - 2;
+}
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+// put the request starting at b on vq's ring, without telling
+// the device. caller holds vq->lock and has checked room().
+static void
+submit(struct vq *vq, struct buf *b)
+{
+  uint64 sector = b->blockno * (BSIZE / 512);
+  struct virtq_desc *d;
+  int n = b->rq.n;
+  int head, i;
+
+  // the spec's Section 5.2 says that block operations use
+  // one descriptor for type/reserved/sector, then one per data
+  // segment, then one for a 1-byte status result. with
+  // indirect descriptors they go in a table of their own, and
+  // the ring holds one descriptor pointing at it.
+  int idx[MAXSEG + 2];
+  if(disk.indirect){
+    if((head = alloc_desc(vq)) < 0)
+      panic("virtio submit");
+    d = vq->indirect[head];
+    for(i = 0; i < n + 2; i++)
+      idx[i] = i;
+    vq->desc[head].addr = (uint64) d;
+    vq->desc[head].len = (n + 2) * sizeof(struct virtq_desc);
+    vq->desc[head].flags = VRING_DESC_F_INDIRECT;
+    vq->desc[head].next = 0;
+  } else {
+    if(allocn_desc(vq, idx, n + 2) < 0)
+      panic("virtio submit");
+    d = vq->desc;
+    head = idx[0];
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &vq->ops[head];
 
-  if(write)
+  if(b->rq.write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(struct virtio_blk_req);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
+
+  vq->info[head].b = b;
+  for(i = 1; i <= n; i++, b = b->qnext){
+    d[idx[i]].addr = (uint64) b->data;
+    d[idx[i]].len = BSIZE;
+    if(buf0->type == VIRTIO_BLK_T_OUT)
+      d[idx[i]].flags = 0; // device reads b->data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  vq->info[head].status = 0xff; // device writes 0 on success
+  d[idx[n+1]].addr = (uint64) &vq->info[head].status;
+  d[idx[n+1]].len = 1;
+  d[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[idx[n+1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  vq->avail->ring[vq->avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  vq->avail->idx += 1; // not % NUM ...
+}
+
+// with event indices: has the index moved from old to new
+// past the event the other side asked about? from the spec.
+static int
+need_event(uint16 event, uint16 new, uint16 old)
+{
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
+
+// give vq as many requests as the I/O scheduler releases and
+// the ring has room for, then tell the device once, if it
+// wants to know. caller holds vq->lock.
+static void
+dispatch(struct vq *vq)
+{
+  uint16 old = vq->avail->idx;
+  struct buf *b;
+
+  while((b = iosched_next(vq - disk.vq, room(vq))) != 0)
+    submit(vq, b);
+  if(vq->avail->idx == old)
+    return;
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  if(!disk.eventidx || need_event(vq->used->avail_event, vq->avail->idx, old)){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = vq - disk.vq; // value is queue number
+    __sync_fetch_and_add(&disk.notifies, 1);
+  }
+}
+
+// start transfers for the n bufs in bv, which hold consecutive
+// blocks, and return without waiting for them to finish. they
+// are queued with the I/O scheduler as requests of at most
+// maxseg blocks on this hart's queue, and dispatched. an async
+// request's bufs are handed to bdone() when it completes.
+void
+virtio_disk_submit(struct buf **bv, int n, int write, int async)
+{
+  struct vq *vq;
+  int i, m, q;
+
+  push_off();
+  q = cpuid() % disk.nvq;
+  vq = &disk.vq[q];
+  acquire(&vq->lock);
+  pop_off();
+  for(; n > 0; bv += m, n -= m){
+    m = n < disk.maxseg ? n : disk.maxseg;
+    for(i = 0; i < m; i++){
+      bv[i]->disk = 1;
+      bv[i]->qnext = i + 1 < m ? bv[i+1] : 0;
+    }
+    iosched_add(q, bv[0], m, write, async);
+  }
+  dispatch(vq);
+  release(&vq->lock);
+}
+
+// finish the requests the device has put on vq's used ring,
+// and refill the ring.
+static void
+vq_intr(struct vq *vq)
+{
+  acquire(&vq->lock);
+
+  // the device increments vq->used->idx when it
+  // adds an entry to the used ring.
+
+  while(1){
+    while(vq->used_idx != vq->used->idx){
+      __sync_synchronize();
+      int id = vq->used->ring[vq->used_idx % NUM].id;
+
+      if(vq->info[id].status != 0)
+        panic("virtio_disk_intr status");
+
+      struct buf *b = vq->info[id].b;
+      vq->info[id].b = 0;
+      free_chain(vq, id);
+      iosched_done(b);
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+      vq->used_idx += 1;
+    }
+    if(!disk.eventidx)
+      break;
+    // ask for an interrupt at the next completion, then look
+    // again in case it landed before the device saw that.
+    vq->avail->used_event = vq->used_idx;
+    __sync_synchronize();
+    if(vq->used_idx == vq->used->idx)
+      break;
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  // the ring has room again.
+  dispatch(vq);
 
-  release(&disk.vdisk_lock);
+  release(&vq->lock);
 }
 
 void
 virtio_disk_intr()
 {
-  acquire(&disk.vdisk_lock);
-
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
@@ -306,25 +472,21 @@ virtio_disk_intr()
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  __sync_fetch_and_add(&disk.intrs, 1);
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
-  }
+  for(int q = 0; q < disk.nvq; q++)
+    vq_intr(&disk.vq[q]);
+}
 
-  release(&disk.vdisk_lock);
+// the driver's part of iostat().
+void
+virtio_disk_stat(struct iostat *st)
+{
+  st->nqueue = disk.nvq;
+  st->indirect = disk.indirect;
+  st->eventidx = disk.eventidx;
+  st->notifies = disk.notifies;
+  st->intrs = disk.intrs;
 }
@@ -314,6 +314,9 @@ pagetable_t kvmmake()
     // virtio mmio disk interface
     mappages(kernel_pagetable, VIRTIO0, PGSIZE, VIRTIO0, PTE_R | PTE_W);
 
+    // CLINT, so harts can send each other ipis
+    mappages(kernel_pagetable, CLINT, 0x10000, CLINT, PTE_R | PTE_W);
+
     // PLIC
     mappages(kernel_pagetable, PLIC, 0x400000, PLIC, PTE_R | PTE_W);
 
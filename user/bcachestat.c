@@ -0,0 +1,25 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+// print buffer cache hit/miss counts and how the cache
+// is split between the 2Q queues.
+
+int
+main(int argc, char **argv)
+{
+  struct bcachestat st;
+  uint64 n;
+
+  if(bcachestat(&st) < 0){
+    fprintf(2, "bcachestat: failed\n");
+    exit(1);
+  }
+  n = st.hits + st.misses;
+  printf("hits %l misses %l ghosthits %l hit%% %l\n", st.hits, st.misses,
+         st.ghosthits, n ? st.hits * 100 / n : 0);
+  printf("buffers %l a1in %l am %l evictions %l readahead %l\n", st.nbuf,
+         st.nin, st.nam, st.evictions, st.ahead);
+  exit(0);
+}
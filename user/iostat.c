@@ -0,0 +1,33 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+// print the disk I/O scheduler's per-direction queue depths,
+// request counts and completion latency histograms.
+
+int
+main(int argc, char **argv)
+{
+  struct iostat st;
+  struct ioqstat *q;
+  int d, i;
+
+  if(iostat(&st) < 0){
+    fprintf(2, "iostat: failed\n");
+    exit(1);
+  }
+  printf("scheduler %s queues %d indirect %d eventidx %d\n", st.sched,
+         st.nqueue, st.indirect, st.eventidx);
+  printf("notifies %l interrupts %l\n", st.notifies, st.intrs);
+  for(d = 0; d < 2; d++){
+    q = &st.q[d];
+    printf("%s: reqs %l blocks %l merges %l queued %l maxqueued %l inflight %l\n",
+           d == IO_READ ? "read" : "write", q->reqs, q->blocks, q->merges,
+           q->queued, q->maxqueued, q->inflight);
+    for(i = 0; i < NIOHIST; i++)
+      if(q->hist[i])
+        printf("  <%lus %l\n", 2UL << i, q->hist[i]);
+  }
+  exit(0);
+}
@@ -0,0 +1,26 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// print the most contended kernel spinlocks.
+// needs a kernel built with make LOCKSTAT=1.
+
+struct lockstat ls[16];
+
+int
+main(int argc, char **argv)
+{
+  int i, n;
+
+  n = argc > 1 ? atoi(argv[1]) : 10;
+  if((n = lockstat(ls, n)) < 0){
+    fprintf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit(1);
+  }
+  printf("name acquires contended spin maxhold\n");
+  for(i = 0; i < n; i++)
+    printf("%s %l %l %l %l\n", ls[i].name, ls[i].acquires,
+           ls[i].contended, ls[i].spin, ls[i].maxhold);
+  exit(0);
+}
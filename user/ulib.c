@@ -1,6 +1,9 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 //
 // wrapper so that it's OK if main() does not call exit().
@@ -146,3 +149,35 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+//
+// clock reads through the kernel's VDSO page, without a trap.
+//
+
+// nanoseconds since boot.
+uint64
+clock_ns(void)
+{
+  struct vdso *v = (struct vdso *)VDSO;
+  uint64 t = r_time() - v->boottime;
+
+  return t / v->timebase * 1000000000 + t % v->timebase * 1000000000 / v->timebase;
+}
+
+// scheduler ticks since boot, as of the last trap;
+// seqlock read side.
+uint64
+clock_ticks(void)
+{
+  struct vdso *v = (struct vdso *)VDSO;
+  uint32 seq;
+  uint64 t;
+
+  do {
+    seq = v->seq;
+    __sync_synchronize();
+    t = v->ticks;
+    __sync_synchronize();
+  } while((seq & 1) || seq != v->seq);
+  return t;
+}
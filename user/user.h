@@ -1,4 +1,11 @@
 struct stat;
+struct cpustat;
+struct timespec;
+struct lockstat;
+struct rusage;
+struct ring;
+struct bcachestat;
+struct iostat;
 
 // system calls
 int fork(void);
@@ -22,6 +29,24 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int cpustat(int, struct cpustat*);
+int nanosleep(const struct timespec*, struct timespec*);
+int clock_gettime(int, struct timespec*);
+int clone(void (*)(void*, void*), void*, void*, void*);
+int join(void**);
+int futex_wait(int*, int, const struct timespec*);
+int futex_wake(int*, int);
+int sched_setaffinity(int, uint64);
+int sched_getaffinity(int, uint64*);
+int lockstat(struct lockstat*, int);
+int getrusage(int, struct rusage*);
+struct ring* ring_setup(void);
+int ring_enter(int);
+int fsync(int);
+int sync(void);
+int bcachestat(struct bcachestat*);
+int iostat(struct iostat*);
+int bcachelimit(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +64,24 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 clock_ns(void);
+uint64 clock_ticks(void);
+
+// uthread.c
+struct mutex {
+  int state;    // 0 unlocked, 1 locked, 2 locked with waiters
+};
+struct cond {
+  int seq;
+};
+int thread_create(void (*)(void*), void*);
+int thread_join(void);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+int cond_timedwait(struct cond*, struct mutex*, const struct timespec*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
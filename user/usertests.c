@@ -7,6 +7,13 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/cpustat.h"
+#include "kernel/rusage.h"
+#include "kernel/ring.h"
+#include "kernel/time.h"
+#include "kernel/vdso.h"
+#include "kernel/bcachestat.h"
+#include "kernel/iostat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2571,6 +2578,1255 @@ badarg(char *s)
   exit(0);
 }
 
+// per-hart idle accounting: a hart cannot have been idle
+// for longer than it has been up, and bad harts are rejected.
+void
+cpustattest(char *s)
+{
+  struct cpustat st;
+
+  if(cpustat(0, &st) < 0){
+    printf("%s: cpustat(0) failed\n", s);
+    exit(1);
+  }
+  if(st.idle > st.uptime){
+    printf("%s: idle time exceeds uptime\n", s);
+    exit(1);
+  }
+  if(cpustat(-1, &st) != -1 || cpustat(N_CPU, &st) != -1){
+    printf("%s: cpustat accepted a bad hart\n", s);
+    exit(1);
+  }
+  if(cpustat(0, (struct cpustat*)0xffffffffffffffff) != -1){
+    printf("%s: cpustat accepted a bad address\n", s);
+    exit(1);
+  }
+}
+
+// nanosleep() must not return early, and the monotonic
+// clock must not go backwards across it.
+void
+nanosleeptest(char *s)
+{
+  struct timespec t0, t1, req;
+  uint64 ns0, ns1;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0){
+    printf("%s: clock_gettime failed\n", s);
+    exit(1);
+  }
+  req.tv_sec = 0;
+  req.tv_nsec = 20000000; // 20 ms
+  if(nanosleep(&req, 0) < 0){
+    printf("%s: nanosleep failed\n", s);
+    exit(1);
+  }
+  if(clock_gettime(CLOCK_MONOTONIC, &t1) < 0){
+    printf("%s: clock_gettime failed\n", s);
+    exit(1);
+  }
+  ns0 = t0.tv_sec * 1000000000 + t0.tv_nsec;
+  ns1 = t1.tv_sec * 1000000000 + t1.tv_nsec;
+  if(ns1 < ns0 + req.tv_nsec){
+    printf("%s: nanosleep returned early\n", s);
+    exit(1);
+  }
+  req.tv_nsec = 1000000000;
+  if(nanosleep(&req, 0) != -1){
+    printf("%s: nanosleep accepted tv_nsec >= 1e9\n", s);
+    exit(1);
+  }
+  if(clock_gettime(0, &t0) != -1){
+    printf("%s: clock_gettime accepted a bad clock\n", s);
+    exit(1);
+  }
+}
+
+// the VDSO clock page: readable, consistent with the
+// system calls, and not writable from user space.
+void
+vdsotest(char *s)
+{
+  struct vdso *v = (struct vdso *)VDSO;
+  uint64 t0, t1;
+  int pid, xstatus;
+
+  if(v->pid != getpid()){
+    printf("%s: vdso pid %d, getpid %d\n", s, v->pid, getpid());
+    exit(1);
+  }
+  t0 = clock_ns();
+  sleep(1);
+  t1 = clock_ns();
+  if(t1 <= t0){
+    printf("%s: clock_ns went backwards\n", s);
+    exit(1);
+  }
+  if(clock_ticks() > uptime()){
+    printf("%s: vdso ticks ahead of uptime\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    v->ticks = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to vdso page succeeded\n", s);
+    exit(1);
+  }
+}
+
+#define NTHREAD 4
+static volatile int threadout[NTHREAD];
+static int threadfd;
+
+static void
+threadfn(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  threadout[i] = i + 1;
+  if(i == 0)
+    threadfd = open("threadf", O_CREATE|O_RDWR);
+}
+
+static void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// clone()d threads share memory and open files, are reaped
+// by join(), and are killed when the process exits.
+void
+threadtest(char *s)
+{
+  int i, n, pid, xstatus;
+
+  threadfd = -1;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(threadfn, (void*)(uint64)i) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(n = 0; thread_join() > 0; n++)
+    ;
+  if(n != NTHREAD){
+    printf("%s: joined %d threads, expected %d\n", s, n, NTHREAD);
+    exit(1);
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(threadout[i] != i + 1){
+      printf("%s: thread %d did not run\n", s, i);
+      exit(1);
+    }
+  }
+  if(threadfd < 0 || write(threadfd, "x", 1) != 1){
+    printf("%s: fd opened by thread not shared\n", s);
+    exit(1);
+  }
+  close(threadfd);
+  unlink("threadf");
+  if(wait(0) != -1){
+    printf("%s: wait() returned a thread\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(thread_create(threadspin, 0) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: exit with a running thread failed\n", s);
+    exit(1);
+  }
+}
+
+#define NLOCKER 3
+#define NLOCKS 2000
+static struct mutex futexmu;
+static struct cond futexcv;
+static volatile int futexcount, futexready;
+
+static void
+futexlocker(void *arg)
+{
+  for(int i = 0; i < NLOCKS; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+}
+
+static void
+futexwaiter(void *arg)
+{
+  mutex_lock(&futexmu);
+  while(!futexready)
+    cond_wait(&futexcv, &futexmu);
+  futexcount++;
+  mutex_unlock(&futexmu);
+}
+
+// futex_wait()/futex_wake() and the ulib mutex and
+// condition variable built on them.
+void
+futextest(char *s)
+{
+  int word = 1;
+  struct timespec ts;
+  int i;
+
+  if(futex_wait(&word, 0, 0) != -1){
+    printf("%s: futex_wait on a changed word blocked\n", s);
+    exit(1);
+  }
+  ts.tv_sec = 0;
+  ts.tv_nsec = 10000000;
+  if(futex_wait(&word, 1, &ts) != 1){
+    printf("%s: futex_wait did not time out\n", s);
+    exit(1);
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf("%s: futex_wake woke a waiter that isn't there\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  cond_init(&futexcv);
+  futexcount = 0;
+  for(i = 0; i < NLOCKER; i++){
+    if(thread_create(futexlocker, 0) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  while(thread_join() > 0)
+    ;
+  if(futexcount != NLOCKER*NLOCKS){
+    printf("%s: count %d, expected %d\n", s, futexcount, NLOCKER*NLOCKS);
+    exit(1);
+  }
+
+  futexcount = 0;
+  futexready = 0;
+  for(i = 0; i < NLOCKER; i++){
+    if(thread_create(futexwaiter, 0) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  sleep(1);
+  mutex_lock(&futexmu);
+  futexready = 1;
+  cond_broadcast(&futexcv);
+  mutex_unlock(&futexmu);
+  while(thread_join() > 0)
+    ;
+  if(futexcount != NLOCKER){
+    printf("%s: %d of %d waiters woke\n", s, futexcount, NLOCKER);
+    exit(1);
+  }
+}
+
+// affinity masks are checked, stick, and are inherited by fork().
+void
+affinitytest(char *s)
+{
+  uint64 mask;
+  int pid, xstatus;
+
+  if(sched_getaffinity(0, &mask) < 0 || mask != CPUMASK_ALL){
+    printf("%s: default mask %p\n", s, mask);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) != -1 || sched_setaffinity(0, ~CPUMASK_ALL) != -1){
+    printf("%s: empty mask accepted\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(-1, CPUMASK_ALL) != -1 || sched_getaffinity(-1, &mask) != -1){
+    printf("%s: bad pid accepted\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 1) < 0 || sched_getaffinity(getpid(), &mask) < 0 || mask != 1){
+    printf("%s: could not pin to hart 0\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(sched_getaffinity(0, &mask) < 0 || mask != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit mask\n", s);
+    exit(1);
+  }
+  sched_setaffinity(0, CPUMASK_ALL);
+}
+
+// many processes looking up and reading the same directory and
+// file at once, under the inodes' shared locks, while another
+// process writes to the directory.
+void
+sharedreadtest(char *s)
+{
+  enum { NCHILD = 4, NITER = 50 };
+  char buf[16];
+  int fd, i, j, pid, xstatus;
+  struct stat st;
+
+  unlink("sharedrd");
+  fd = open("sharedrd", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, "shared-read", 11) != 11){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < NITER; j++){
+        if(i == 0){
+          // the writer: churn entries in the same directory.
+          fd = open("sharedwr", O_CREATE|O_WRONLY);
+          close(fd);
+          unlink("sharedwr");
+          continue;
+        }
+        fd = open("sharedrd", O_RDONLY);
+        if(fd < 0 || read(fd, buf, sizeof(buf)) != 11 || memcmp(buf, "shared-read", 11) != 0)
+          exit(1);
+        close(fd);
+        if(stat(".", &st) < 0 || st.type != T_DIR)
+          exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: concurrent read failed\n", s);
+      exit(1);
+    }
+  }
+  unlink("sharedrd");
+}
+
+// two processes closing the last opens of an unlinked file at
+// once: exactly one must free it, or its inode and blocks leak
+// and the next create gets a different inode number.
+void
+unlinkclosetest(char *s)
+{
+  enum { NCHILD = 2, NITER = 20 };
+  char buf[BSIZE];
+  int ready[2], go[2];
+  int fd, i, j, pid, xstatus;
+  uint ino = 0;
+  struct stat st;
+
+  memset(buf, 'u', sizeof(buf));
+  for(i = 0; i < NITER; i++){
+    unlink("unlinkcf");
+    fd = open("unlinkcf", O_CREATE|O_RDWR);
+    if(fd < 0 || fstat(fd, &st) < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    if(i == 0)
+      ino = st.ino;
+    if(st.ino != ino){
+      printf("%s: round %d: inode %d leaked\n", s, i, ino);
+      exit(1);
+    }
+    for(j = 0; j < 8; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+
+    if(pipe(ready) < 0 || pipe(go) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < NCHILD; j++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        // each child opens the file itself, so each close
+        // drops its own inode reference.
+        close(ready[0]);
+        close(go[1]);
+        if((fd = open("unlinkcf", O_RDONLY)) < 0)
+          exit(1);
+        write(ready[1], "r", 1);
+        read(go[0], buf, 1);
+        close(fd);
+        exit(0);
+      }
+    }
+    close(ready[1]);
+    close(go[0]);
+    for(j = 0; j < NCHILD; j++){
+      if(read(ready[0], buf, 1) != 1){
+        printf("%s: child did not open the file\n", s);
+        exit(1);
+      }
+    }
+    if(unlink("unlinkcf") < 0){
+      printf("%s: unlink failed\n", s);
+      exit(1);
+    }
+    // closing go releases both children at once.
+    close(go[1]);
+    close(ready[0]);
+    for(j = 0; j < NCHILD; j++){
+      wait(&xstatus);
+      if(xstatus != 0){
+        printf("%s: child failed\n", s);
+        exit(1);
+      }
+    }
+  }
+}
+
+// getrusage() counts our own system calls and sleeps, and
+// folds a reaped child's usage into RUSAGE_CHILDREN.
+void
+rusagetest(char *s)
+{
+  struct rusage ru0, ru1;
+  int i, pid, xstatus;
+  volatile int spin;
+
+  if(getrusage(RUSAGE_SELF, &ru0) < 0){
+    printf("%s: getrusage failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++)
+    getpid();
+  sleep(1);
+  if(getrusage(RUSAGE_SELF, &ru1) < 0){
+    printf("%s: getrusage failed\n", s);
+    exit(1);
+  }
+  if(ru1.syscalls[SYS_getpid] < ru0.syscalls[SYS_getpid] + 10){
+    printf("%s: getpid calls not counted\n", s);
+    exit(1);
+  }
+  if(ru1.nvcsw <= ru0.nvcsw){
+    printf("%s: sleep not counted as a voluntary switch\n", s);
+    exit(1);
+  }
+  if(getrusage(2, &ru1) != -1){
+    printf("%s: bad who accepted\n", s);
+    exit(1);
+  }
+
+  getrusage(RUSAGE_CHILDREN, &ru0);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(spin = 0; spin < 1000000; spin++)
+      ;
+    for(i = 0; i < 5; i++)
+      getpid();
+    exit(0);
+  }
+  wait(&xstatus);
+  getrusage(RUSAGE_CHILDREN, &ru1);
+  if(ru1.syscalls[SYS_getpid] < ru0.syscalls[SYS_getpid] + 5 || ru1.utime <= ru0.utime){
+    printf("%s: child usage not added on wait\n", s);
+    exit(1);
+  }
+}
+
+// fp registers survive context switches between processes
+// that both use them, and a fork()ed child inherits them.
+static double
+fpspin(double x, int n)
+{
+  volatile double acc = x;
+
+  // long enough to be preempted by the timer several times.
+  for(int i = 0; i < n; i++)
+    acc = acc * 1.0000001 + 0.5;
+  return acc;
+}
+
+void
+fptest(char *s)
+{
+  double expect[2], got;
+  int pid, xstatus;
+
+  expect[0] = fpspin(1.0, 3000000);
+  expect[1] = fpspin(-7.0, 3000000);
+
+  // hold a value in callee-saved fs0 across fork(); the empty asm
+  // statements force it into the register before the call and make
+  // the child read it back from there rather than from memory.
+  register double inherited asm("fs0") = 3.25;
+  asm volatile("" : "+f"(inherited));
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    asm volatile("" : "+f"(inherited));
+    if(inherited != 3.25)
+      exit(2);
+    exit(fpspin(-7.0, 3000000) == expect[1] ? 0 : 1);
+  }
+  got = fpspin(1.0, 3000000);
+  wait(&xstatus);
+  if(got != expect[0] || xstatus != 0){
+    printf("%s: fp state corrupted across switches (%d)\n", s, xstatus);
+    exit(1);
+  }
+}
+
+static void
+ringsubmit(struct ring *r, int op, uint64 a0, uint64 a1, uint64 a2, uint64 tag)
+{
+  struct sqe *e = &r->sq[r->sq_tail % RING_ENTRIES];
+
+  e->op = op;
+  e->args[0] = a0;
+  e->args[1] = a1;
+  e->args[2] = a2;
+  e->user_data = tag;
+  __sync_synchronize();
+  r->sq_tail++;
+}
+
+// several system calls issued by one ring_enter().
+void
+ringtest(char *s)
+{
+  struct ring *r;
+  struct stat st;
+  struct cqe *c;
+  char buf[8];
+  int fd, n, i;
+
+  if((r = ring_setup()) == (struct ring*)-1 || ring_setup() != r){
+    printf("%s: ring_setup failed\n", s);
+    exit(1);
+  }
+  unlink("ringf");
+  fd = open("ringf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  ringsubmit(r, SYS_write, fd, (uint64)"ring!", 5, 1);
+  ringsubmit(r, SYS_fstat, fd, (uint64)&st, 0, 2);
+  ringsubmit(r, SYS_close, fd, 0, 0, 3);
+  ringsubmit(r, SYS_open, (uint64)"ringf", O_RDONLY, 0, 4);
+  ringsubmit(r, SYS_fork, 0, 0, 0, 5);
+  if((n = ring_enter(RING_ENTRIES)) != 5){
+    printf("%s: ring_enter ran %d entries\n", s, n);
+    exit(1);
+  }
+  for(i = 0; r->cq_head != r->cq_tail; i++){
+    c = &r->cq[r->cq_head % RING_ENTRIES];
+    if(c->user_data != i + 1){
+      printf("%s: completion %d out of order\n", s, i);
+      exit(1);
+    }
+    if((i == 0 && c->res != 5) || (i == 1 && (c->res != 0 || st.size != 5)) ||
+       (i == 2 && c->res != 0) || (i == 3 && c->res < 0) || (i == 4 && c->res != -1)){
+      printf("%s: completion %d: res %d\n", s, i, (int)c->res);
+      exit(1);
+    }
+    if(i == 3)
+      fd = c->res;
+    r->cq_head++;
+  }
+  if(read(fd, buf, sizeof(buf)) != 5 || memcmp(buf, "ring!", 5) != 0){
+    printf("%s: data written through the ring is wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ringf");
+}
+
+static void
+ringdrainer(void *arg)
+{
+  while(ring_enter(1) > 0)
+    ;
+}
+
+// two threads draining one ring run each entry exactly once
+// and post exactly one completion for it.
+void
+ringthreadtest(char *s)
+{
+  enum { NROUND = 4 };
+  char data[NROUND*RING_ENTRIES], buf[NROUND*RING_ENTRIES];
+  char seen[NROUND*RING_ENTRIES];
+  struct ring *r;
+  struct cqe *c;
+  int fd, round, i, n;
+
+  if((r = ring_setup()) == (struct ring*)-1){
+    printf("%s: ring_setup failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + i % 26;
+  unlink("ringtf");
+  fd = open("ringtf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, sizeof(data)) != sizeof(data)){
+    printf("%s: create ringtf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("ringtf", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open ringtf failed\n", s);
+    exit(1);
+  }
+  memset(seen, 0, sizeof(seen));
+  memset(buf, 0, sizeof(buf));
+  for(round = 0; round < NROUND; round++){
+    // each entry reads one byte at the shared offset; an entry
+    // run twice would read past the end of the file.
+    for(i = 0; i < RING_ENTRIES; i++){
+      n = round*RING_ENTRIES + i;
+      ringsubmit(r, SYS_read, fd, (uint64)&buf[n], 1, n);
+    }
+    for(i = 0; i < 2; i++){
+      if(thread_create(ringdrainer, 0) < 0){
+        printf("%s: thread_create failed\n", s);
+        exit(1);
+      }
+    }
+    while(thread_join() > 0)
+      ;
+    if(r->sq_head != r->sq_tail || r->cq_tail - r->cq_head != RING_ENTRIES){
+      printf("%s: round %d: %d entries left, %d completions\n", s, round,
+             r->sq_tail - r->sq_head, r->cq_tail - r->cq_head);
+      exit(1);
+    }
+    while(r->cq_head != r->cq_tail){
+      c = &r->cq[r->cq_head % RING_ENTRIES];
+      if(c->user_data >= sizeof(seen) || seen[c->user_data]++ || c->res != 1){
+        printf("%s: bad completion %d res %d\n", s, (int)c->user_data, (int)c->res);
+        exit(1);
+      }
+      r->cq_head++;
+    }
+  }
+  for(i = 0; i < sizeof(seen); i++){
+    if(seen[i] != 1){
+      printf("%s: entry %d completed %d times\n", s, i, seen[i]);
+      exit(1);
+    }
+  }
+  // bytes may land out of order across threads, but each
+  // one exactly once.
+  memset(seen, 0, sizeof(seen));
+  for(i = 0; i < sizeof(buf); i++)
+    seen[(uchar)buf[i] - 'a']++;
+  for(i = 0; i < 26; i++){
+    n = sizeof(data) / 26 + (i < sizeof(data) % 26);
+    if(seen[i] != n){
+      printf("%s: read %d of byte %c, expected %d\n", s, seen[i], 'a' + i, n);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("ringtf");
+}
+
+// concurrent creates, writes and unlinks share log
+// transactions; a write larger than one transaction is
+// split across several commits.
+void
+logtest(char *s)
+{
+  enum { NCHILD = 4, NLOGF = 8 };
+  char name[8], buf[512];
+  int pid, fd, i, j, xstatus;
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'l';
+      name[1] = 'a' + i;
+      name[3] = 0;
+      memset(buf, 'a' + i, sizeof(buf));
+      for(j = 0; j < NLOGF; j++){
+        name[2] = '0' + j;
+        fd = open(name, O_CREATE|O_RDWR);
+        if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+        if(j % 2 && unlink(name) < 0){
+          printf("%s: unlink %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  name[0] = 'l';
+  name[3] = 0;
+  for(i = 0; i < NCHILD; i++){
+    name[1] = 'a' + i;
+    for(j = 0; j < NLOGF; j++){
+      name[2] = '0' + j;
+      fd = open(name, O_RDONLY);
+      if(j % 2){
+        if(fd >= 0){
+          printf("%s: %s still exists\n", s, name);
+          exit(1);
+        }
+        continue;
+      }
+      if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' + i || buf[511] != 'a' + i){
+        printf("%s: %s has wrong contents\n", s, name);
+        exit(1);
+      }
+      close(fd);
+      unlink(name);
+    }
+  }
+
+  fd = open("logbig", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open logbig failed\n", s);
+    exit(1);
+  }
+  char *big = malloc(16*1024);
+  memset(big, 'x', 16*1024);
+  if(write(fd, big, 16*1024) != 16*1024){
+    printf("%s: big write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  free(big);
+  unlink("logbig");
+}
+
+// fsync() and sync() commit delayed writes; the data must
+// read back the same either way.
+void
+fsynctest(char *s)
+{
+  char buf[BSIZE];
+  int fd, i;
+
+  if(fsync(-1) != -1 || fsync(100) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 8; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(i == 3 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("fsyncf", O_RDONLY);
+  for(i = 0; i < 8; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' + i || buf[BSIZE-1] != 'a' + i){
+      printf("%s: block %d reads back wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("fsyncf");
+}
+
+// several processes hit and miss in the buffer cache at once,
+// each on blocks of its own file and on the shared root dir.
+void
+bcachetest(char *s)
+{
+  enum { NCHILD = 4, NBLK = 12 };
+  char name[4], buf[BSIZE];
+  int pid, fd, i, j, k, xstatus;
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'b';
+      name[1] = 'c';
+      name[2] = 'a' + i;
+      name[3] = 0;
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      for(j = 0; j < NBLK; j++){
+        memset(buf, 'a' + i + j, sizeof(buf));
+        if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+          printf("%s: write failed\n", s);
+          exit(1);
+        }
+      }
+      close(fd);
+      for(k = 0; k < 5; k++){
+        fd = open(name, O_RDONLY);
+        for(j = 0; j < NBLK; j++){
+          if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[7] != 'a' + i + j){
+            printf("%s: %s block %d reads back wrong\n", s, name, j);
+            exit(1);
+          }
+        }
+        close(fd);
+      }
+      unlink(name);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
+static void
+bcgrowread(char *s, int nblk)
+{
+  char buf[BSIZE];
+  int fd, i;
+
+  fd = open("bcgrow", O_RDONLY);
+  for(i = 0; i < nblk; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != (char)i){
+      printf("%s: block %d reads back wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// the buffer cache grows past its boot size while a big file
+// is read, then must give memory back when sbrk() wants it all,
+// and grows again when the file is read once more.
+void
+bcachegrowtest(char *s)
+{
+  enum { NBLK = 200 };
+  struct bcachestat st0, st1, st2;
+  char buf[BSIZE];
+  char *a, *prev;
+  int fd, i;
+  uint64 got;
+
+  fd = open("bcgrow", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  bcgrowread(s, NBLK);
+  bcachestat(&st0);
+  if(st0.nbuf < NBLK){
+    printf("%s: cache of %l buffers did not grow to hold the file\n", s, st0.nbuf);
+    exit(1);
+  }
+
+  // take all of memory, then give it back.
+  prev = sbrk(0);
+  got = 0;
+  while((a = sbrk(64*4096)) != (char*)-1)
+    got += 64*4096;
+  if(got == 0){
+    printf("%s: sbrk got nothing\n", s);
+    exit(1);
+  }
+  sbrk(-(int)(sbrk(0) - prev));
+  bcachestat(&st1);
+  if(st1.nbuf >= st0.nbuf){
+    printf("%s: cache did not shrink: %l buffers, was %l\n", s, st1.nbuf, st0.nbuf);
+    exit(1);
+  }
+
+  bcgrowread(s, NBLK);
+  bcachestat(&st2);
+  if(st2.nbuf <= st1.nbuf){
+    printf("%s: cache did not grow back: %l buffers, was %l\n", s, st2.nbuf, st1.nbuf);
+    exit(1);
+  }
+  unlink("bcgrow");
+}
+
+// reading a file again should hit in the buffer cache.
+void
+bcachestattest(char *s)
+{
+  enum { NBLK = 20 };
+  struct bcachestat st0, st1;
+  char buf[BSIZE];
+  int fd, i;
+
+  fd = open("bcstat", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+  fd = open("bcstat", O_RDONLY);
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+
+  if(bcachestat(&st0) < 0){
+    printf("%s: bcachestat failed\n", s);
+    exit(1);
+  }
+  fd = open("bcstat", O_RDONLY);
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  bcachestat(&st1);
+  if(st1.hits - st0.hits < NBLK || st1.misses - st0.misses >= NBLK){
+    printf("%s: rereading missed: hits %l misses %l\n", s,
+           st1.hits - st0.hits, st1.misses - st0.misses);
+    exit(1);
+  }
+  if(st1.nin + st1.nam > st1.nbuf){
+    printf("%s: queues hold more than the cache\n", s);
+    exit(1);
+  }
+  unlink("bcstat");
+}
+
+static void
+bchotread(void)
+{
+  char buf[BSIZE];
+  int fd;
+
+  fd = open("bchot", O_RDONLY);
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+}
+
+// 2Q: a big sequential read should not push a small, hot
+// file out of the buffer cache. the cache is capped well
+// below the size of the scan, so blocks are evicted; the hot
+// blocks, reread soon after each eviction from a1in, come back
+// as ghost hits and move to am, which the scan leaves alone.
+void
+bcachescantest(char *s)
+{
+  enum { HOT = 4, NCACHE = 160 };
+  struct bcachestat st0, st1, st2, st3;
+  char buf[BSIZE];
+  int fd, hfd, i, old;
+
+  old = bcachelimit(NCACHE);
+  bcachestat(&st0);
+  if(st0.nbuf >= MAXFILE){
+    printf("%s: cache of %l buffers not capped\n", s, st0.nbuf);
+    exit(1);
+  }
+
+  fd = open("bchot", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < HOT; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+  fd = open("bcscan", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < MAXFILE; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // stream the big file, rereading the hot one as we go.
+  bcachestat(&st0);
+  fd = open("bcscan", O_RDONLY);
+  for(i = 0; read(fd, buf, sizeof(buf)) > 0; i++)
+    if(i % 8 == 0)
+      bchotread();
+  close(fd);
+  bcachestat(&st1);
+  if(st1.evictions == st0.evictions){
+    printf("%s: a scan bigger than the cache evicted nothing\n", s);
+    exit(1);
+  }
+  if(st1.ghosthits - st0.ghosthits < HOT || st1.nam < HOT){
+    printf("%s: hot blocks not promoted: ghosthits %l am %l\n", s,
+           st1.ghosthits - st0.ghosthits, st1.nam);
+    exit(1);
+  }
+
+  // stream it again without touching the hot file.
+  fd = open("bcscan", O_RDONLY);
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  hfd = open("bchot", O_RDONLY);
+  bcachestat(&st2);
+  if(st2.evictions == st1.evictions){
+    printf("%s: second scan evicted nothing\n", s);
+    exit(1);
+  }
+  while(read(hfd, buf, sizeof(buf)) > 0)
+    ;
+  close(hfd);
+  bcachestat(&st3);
+  if(st3.misses != st2.misses || st3.hits - st2.hits < HOT){
+    printf("%s: hot file evicted by a scan: hits %l misses %l\n", s,
+           st3.hits - st2.hits, st3.misses - st2.misses);
+    exit(1);
+  }
+  unlink("bcscan");
+  unlink("bchot");
+  bcachelimit(old);
+}
+
+// two processes read the same file sequentially, in pieces
+// that straddle blocks, through the direct and indirect blocks,
+// while read-ahead runs in front of each of them.
+void
+readaheadtest(char *s)
+{
+  enum { NBLK = 40, CHUNK = 300 };
+  struct bcachestat st0, st1;
+  char buf[BSIZE];
+  int fd, i, n, off, pid, xstatus;
+
+  fd = open("rahead", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, 'A' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  bcachestat(&st0);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  fd = open("rahead", O_RDONLY);
+  off = 0;
+  while((n = read(fd, buf, CHUNK)) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != 'A' + (off + i) / BSIZE){
+        printf("%s: byte %d reads back wrong\n", s, off + i);
+        exit(1);
+      }
+    }
+    off += n;
+  }
+  close(fd);
+  if(off != NBLK * BSIZE){
+    printf("%s: read %d bytes\n", s, off);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  // each reader's window should have covered most of the file,
+  // however their reads interleaved.
+  bcachestat(&st1);
+  if(st1.ahead - st0.ahead < NBLK){
+    printf("%s: read ahead only %l blocks\n", s, st1.ahead - st0.ahead);
+    exit(1);
+  }
+  unlink("rahead");
+}
+
+// writes forced out by fsync() should show up in the I/O
+// scheduler's counters, and every completed request in a
+// latency bucket.
+void
+iostattest(char *s)
+{
+  enum { NBLK = 20 };
+  struct iostat st0, st1;
+  char buf[BSIZE];
+  uint64 n;
+  int fd, d, i;
+
+  if(iostat(&st0) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  fd = open("iostest", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < NBLK; i++)
+    write(fd, buf, sizeof(buf));
+  fsync(fd);
+  close(fd);
+  iostat(&st1);
+  if(st1.sched[0] == 0){
+    printf("%s: no scheduler name\n", s);
+    exit(1);
+  }
+  if(st1.q[IO_WRITE].blocks - st0.q[IO_WRITE].blocks < NBLK){
+    printf("%s: wrote only %l blocks\n", s,
+           st1.q[IO_WRITE].blocks - st0.q[IO_WRITE].blocks);
+    exit(1);
+  }
+  for(d = 0; d < 2; d++){
+    n = 0;
+    for(i = 0; i < NIOHIST; i++)
+      n += st1.q[d].hist[i];
+    if(n != st1.q[d].reqs || st1.q[d].reqs > st1.q[d].blocks){
+      printf("%s: counts disagree: reqs %l hist %l blocks %l\n", s,
+             st1.q[d].reqs, n, st1.q[d].blocks);
+      exit(1);
+    }
+  }
+  unlink("iostest");
+}
+
+// a commit writes the log and then the home blocks in runs of
+// adjacent blocks, so requests should carry several blocks
+// each, and with event indices the driver should notify and
+// be interrupted no more than once per request.
+void
+iomergetest(char *s)
+{
+  enum { NBLK = 24 };
+  struct iostat st0, st1;
+  char buf[BSIZE];
+  uint64 blocks, reqs, all;
+  int fd, i;
+
+  iostat(&st0);
+  fd = open("iomerge", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'm', sizeof(buf));
+  for(i = 0; i < NBLK; i++)
+    write(fd, buf, sizeof(buf));
+  fsync(fd);
+  close(fd);
+  iostat(&st1);
+
+  blocks = st1.q[IO_WRITE].blocks - st0.q[IO_WRITE].blocks;
+  reqs = st1.q[IO_WRITE].reqs - st0.q[IO_WRITE].reqs;
+  if(blocks < NBLK || reqs >= blocks){
+    printf("%s: %l blocks written in %l requests\n", s, blocks, reqs);
+    exit(1);
+  }
+  all = reqs + st1.q[IO_READ].reqs - st0.q[IO_READ].reqs;
+  if(st1.notifies - st0.notifies > all || st1.intrs - st0.intrs > all){
+    printf("%s: %l requests, %l notifies, %l interrupts\n", s, all,
+           st1.notifies - st0.notifies, st1.intrs - st0.intrs);
+    exit(1);
+  }
+  if(st1.nqueue < 1){
+    printf("%s: no disk queues\n", s);
+    exit(1);
+  }
+  unlink("iomerge");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2635,6 +3891,27 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {cpustattest, "cpustat" },
+  {nanosleeptest, "nanosleep" },
+  {vdsotest, "vdso" },
+  {threadtest, "thread" },
+  {futextest, "futex" },
+  {affinitytest, "affinity" },
+  {sharedreadtest, "sharedread" },
+  {unlinkclosetest, "unlinkclose" },
+  {rusagetest, "rusage" },
+  {fptest, "fp" },
+  {ringtest, "ring" },
+  {ringthreadtest, "ringthread" },
+  {logtest, "log" },
+  {fsynctest, "fsync" },
+  {bcachetest, "bcache" },
+  {bcachegrowtest, "bcachegrow" },
+  {bcachestattest, "bcachestat" },
+  {bcachescantest, "bcachescan" },
+  {readaheadtest, "readahead" },
+  {iostattest, "iostat" },
+  {iomergetest, "iomerge" },
 
   { 0, 0},
 };
@@ -36,3 +36,21 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("cpustat");
+entry("nanosleep");
+entry("clock_gettime");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("lockstat");
+entry("getrusage");
+entry("ring_setup");
+entry("ring_enter");
+entry("fsync");
+entry("sync");
+entry("bcachestat");
+entry("iostat");
+entry("bcachelimit");
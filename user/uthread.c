@@ -0,0 +1,133 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+//
+// user threads on top of clone() and join().
+// each thread gets a one-page stack from malloc().
+//
+
+static void
+thread_start(void *fn, void *arg)
+{
+  ((void (*)(void*))fn)(arg);
+  exit(0);
+}
+
+// start fn(arg) in a new thread; returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  if((stack = malloc(PGSIZE)) == 0)
+    return -1;
+  if((uint64)stack % 16 != 0 || (pid = clone(thread_start, fn, arg, stack)) < 0){
+    free(stack);
+    return -1;
+  }
+  return pid;
+}
+
+// wait for some thread to exit and free its stack;
+// returns its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) > 0)
+    free(stack);
+  return pid;
+}
+
+//
+// mutex and condition variable on futex_wait() and futex_wake().
+// an uncontended lock or unlock makes no system call.
+//
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // mark it contended, so the holder's unlock wakes us.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2, 0);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+// returns 1 if the lock was taken.
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_val_compare_and_swap(&m->state, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// a signal after the unlock changes seq, so futex_wait()
+// returns at once instead of missing it.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = *(volatile int*)&c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  mutex_lock(m);
+}
+
+// like cond_wait(), but gives up after the relative timeout ts;
+// returns 1 if it timed out.
+int
+cond_timedwait(struct cond *c, struct mutex *m, const struct timespec *ts)
+{
+  int seq = *(volatile int*)&c->seq;
+  int r;
+
+  mutex_unlock(m);
+  r = futex_wait(&c->seq, seq, ts);
+  mutex_lock(m);
+  return r == 1;
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}